@@ -6,84 +6,64 @@
  *
  ******************************************************************************/
 
-#include <Windows.h>
 #include <freeglut.h>
+#include <ctype.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
-#include <time.h>
+#include <stdlib.h>
+
+#include "checkpoint.h"
+#include "commands.h"
+#include "config.h"
+#include "control.h"
+#include "export.h"
+#include "geometry.h"
+#include "governor.h"
+#include "headless.h"
+#include "jobs.h"
+#include "pacer.h"
+#include "pipeline.h"
+#include "platform.h"
+#include "record.h"
+#include "scene.h"
+#include "selftest.h"
+#include "softraster.h"
+#include "timings.h"
+#include "trace.h"
 
 
  /******************************************************************************
   * Animation & Timing Setup
   ******************************************************************************/
 
-  // Target frame rate (number of Frames Per Second).
-#define TARGET_FPS 60
-#define MAX_PARTICLES 1500
-#define M_PI 3.14159f
-#define JUMP_TIME 49
-
 int width = 1000;
 int height = 1000;
 
-int snowCount = 0;
-int timeJumping = 0;
-bool snowFall = false;
 bool showDiagnostic = true;
-bool jumping = false;
-bool dayTime = true;
 
-typedef struct {
-	float x, y;
-} Point;
+// Paces frames to config.fps (60 unless --fps says otherwise).
+FramePacer pacer;
 
-typedef struct {
-	float r, g, b;
-} Colour;
+// Thins the snow when frames run over the pacer's budget (unless --fixed-density).
+Governor governor;
 
-typedef struct {
-	float x, y, speed, size, transparency;
-} Snow;
+// The simulation runs on its own fixed tick; each frame shows it interpolated
+// to the moment think() ran.
+uint64_t lastThinkTime = 0;
+float interpolation = 0.0f;
+SceneView sceneView;
 
-typedef struct {
-	float cx, cy, r;
-	int segments;
-	Colour inner, outer;
-} Snowman;
+// The scene being drawn: the global scene itself or, with --pipeline, the
+// latest snapshot of it from the simulation thread.
+const Scene *shown = &scene;
+const Snapshot *snapshot = NULL;
 
-typedef struct {
-	float x, y;
-	Colour colour;
-} Sun;
-
-Colour WHITE = { 255, 255, 255 };
-Colour GREY = { 130, 151, 173 };
-Colour BLACK = { 0, 0, 0 };
-Colour ORANGE = { 245, 127, 42 };
-Colour YELLOW = { 241, 221, 24 };
-Colour DARKBLUE = { 6, 130, 195 };
-Colour LIGHTBLUE = { 118, 186, 251 };
-
-
-Point groundVertices[4];
-Snow snowParticles[MAX_PARTICLES];
-Snowman snowman[6];
-Sun sun;
-Colour skyTop = { 6, 130, 195 };
-Colour skyBottom = { 118, 186, 251 };
-
-// Ideal time each frame should be displayed for (in milliseconds).
-const unsigned int FRAME_TIME = 1000 / TARGET_FPS;
-
-// Frame time in fractional seconds.
-// Note: This is calculated to accurately reflect the truncated integer value of
-// FRAME_TIME, which is used for timing, rather than the more accurate fractional
-// value we'd get if we simply calculated "FRAME_TIME_SEC = 1.0f / TARGET_FPS".
-const float FRAME_TIME_SEC = (1000 / TARGET_FPS) / 1000.0f;
-
-// Time we started preparing the current frame (in milliseconds since GLUT was initialized).
-unsigned int frameStartTime = 0;
+// Percentiles shown in the diagnostics, refreshed every TIMING_REFRESH frames
+// rather than re-sorting the whole ring every frame.
+#define TIMING_REFRESH 30
+PhaseSummary timingSummary[PHASE_COUNT];
+int framesSinceSummary = TIMING_REFRESH;
 
 /******************************************************************************
  * Keyboard Input Handling Setup
@@ -115,26 +95,117 @@ void idle(void);
 void main(int argc, char **argv);
 void init(void);
 void think(void);
-void createSnow(int i);
 void setColour(int r, int g, int b, float a);
+void buildSceneGeometry(void);
 void drawBackground(void);
+void drawSun(void);
 void drawCircle(float cx, float cy, float r, int numSegments, Colour inner, Colour outer);
 void drawSnow(void);
+void drawSnowCover(void);
 void drawSnowman(void);
 void displayDebug(void);
-Colour fadeColor(Colour start, Colour end);
+void submitCommand(CommandType type, int value);
+void governDensity(const FrameTiming *frame);
+void saveTimings(void);
+void saveTrace(void);
+void saveRecording(void);
+void saveScene(void);
 
 /******************************************************************************
  * Animation-Specific Setup (Add your own definitions, constants, and globals here)
  ******************************************************************************/
 
+// Interleaved position and colour for one flake, as handed to glDrawArrays().
+typedef struct {
+	GLfloat x, y;
+	GLubyte colour[4];
+} SnowVertex;
+
+SnowVertex *snowVertices = NULL;
+int snowVertexCapacity = 0;
+
+// Display lists holding the geometry that never changes shape, built by buildSceneGeometry().
+GLuint groundList = 0;
+GLuint snowmanList = 0;
+GLuint sunList = 0; // unit disc; the sun's colour and position are applied when drawn
+
+// One quad per column of lying snow, rebuilt each frame by drawSnowCover().
+GLfloat coverVertices[SNOW_COLUMNS * 4][2];
+
+// With --software the frame is drawn here on the CPU and copied to the window.
+Framebuffer softwareFrame;
+
+// The sky quad: fixed corners, colours rewritten each frame as the sky fades.
+const GLfloat skyVertices[4][2] = { { 0.0f, 0.0f }, { 1.0f, 0.0f }, { 1.0f, 1.0f }, { 0.0f, 1.0f } };
+GLfloat skyColours[4][4];
+
 /******************************************************************************
  * Entry Point (don't put anything except the main function here)
  ******************************************************************************/
 
 void main(int argc, char **argv)
 {
+	if (!parseArguments(&config, argc, argv)) {
+		exit(1);
+	}
+
+	// "--self-test" runs the regression checks on scenes of its own, then exits.
+	if (config.selfTest) {
+		exit(runSelfTest(&config));
+	}
+
+	// "--trace file" records a timeline of every frame, written out on exit.
+	if (config.trace[0] != '\0') {
+		startTrace();
+		traceThreadName("main", 0);
+		atexit(saveTrace);
+	}
+
+	// "--replay file" runs a recorded session again, seed, settings and input;
+	// "--record file" makes one.
+	if (config.replay[0] != '\0' && !startReplay(config.replay, &config)) {
+		exit(1);
+	}
+	if (config.record[0] != '\0') {
+		if (!startRecording(config.record, &config)) {
+			exit(1);
+		}
+		atexit(saveRecording);
+	}
+
+	// "--checkpoint file" saves the whole scene on exit, for "--resume file" to
+	// start from.
+	if (config.checkpoint[0] != '\0') {
+		atexit(saveScene);
+	}
+
+	if (!initJobs(config.threads)) {
+		fprintf(stderr, "Couldn't start %d worker threads\n", config.threads);
+		exit(1);
+	}
+
+	// "--export frames" renders straight to files (or stdout) without a window.
+	if (config.exportFrames > 0) {
+		exit(runExport(config.exportFrames, config.output));
+	}
+
+	// "--control channel" takes commands from another program while the scene runs.
+	if (config.control[0] != '\0') {
+		if (!startControl(config.control)) {
+			exit(1);
+		}
+		atexit(stopControl);
+	}
+
+	// "--headless [frames]" steps the simulation without ever opening a window.
+	// A replay runs as long as the recording did.
+	if (config.headlessFrames > 0) {
+		exit(runHeadless(isReplaying() && replayLength() > 0 ? (int)replayLength() : config.headlessFrames));
+	}
+
 	// Initialize the OpenGL window.
+	width = config.width;
+	height = config.height;
 	glutInit(&argc, argv);
 	glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
 	glutInitWindowSize(width, height);
@@ -152,8 +223,31 @@ void main(int argc, char **argv)
 	glutKeyboardFunc(keyPressed);
 	glutIdleFunc(idle);
 
-	// Record when we started rendering the very first frame (which should happen after we call glutMainLoop).
-	frameStartTime = (unsigned int)glutGet(GLUT_ELAPSED_TIME);
+	// The first deadline is one frame after we start rendering (which should happen after we call glutMainLoop).
+	initFramePacer(&pacer, config.fps);
+	initGovernor(&governor, pacer.period);
+	lastThinkTime = timeNowNs();
+
+	// exit() is how the window closes, so write the timings from an exit handler.
+	if (config.timings[0] != '\0') {
+		atexit(saveTimings);
+	}
+
+	// From here on only the simulation thread touches the scene.
+	if (config.pipeline) {
+		if (!startPipeline(&scene)) {
+			exit(1);
+		}
+		atexit(stopPipeline);
+		snapshot = acquireSnapshot();
+		shown = &snapshot->scene;
+	}
+
+	// The governor starts at the full budget, even if the last run that saved
+	// a resumed scene had cut it back.
+	if (!config.fixedDensity) {
+		submitCommand(COMMAND_SCALE_BUDGET, BUDGET_SCALE);
+	}
 
 	// Enter the main drawing loop (this will never return).
 	glutMainLoop();
@@ -173,25 +267,49 @@ void main(int argc, char **argv)
 
 void display(void)
 {	
-	// clear the screen
-	glClear(GL_COLOR_BUFFER_BIT);
+	TRACE_BEGIN(zone);
+	uint64_t phaseStart = timeNowNs();
+
+	sceneView = viewScene(shown, interpolation);
 
-	drawBackground();
-	
-	drawCircle(sun.x, sun.y, 0.1f, 100, sun.colour, sun.colour);
-	
-	drawSnowman();
-	
-	//Draw snow if snow is allowed to fall
-	if (snowCount != 0) {
-		drawSnow();
+	if (config.software && softwareFrame.pixels != NULL) {
+		// The whole scene is drawn on the CPU; GL only puts the pixels on screen.
+		TRACE_ZONE("renderScene", renderScene(&softwareFrame, shown, &sceneView));
+		glRasterPos2f(0.0f, 0.0f);
+		glDrawPixels(softwareFrame.width, softwareFrame.height, GL_RGBA, GL_UNSIGNED_BYTE, softwareFrame.pixels);
+		phaseStart = recordPhase(PHASE_SOFTWARE, phaseStart);
+	}
+	else {
+		// clear the screen
+		glClear(GL_COLOR_BUFFER_BIT);
+
+		TRACE_ZONE("drawBackground", drawBackground());
+		phaseStart = recordPhase(PHASE_BACKGROUND, phaseStart);
+
+		TRACE_ZONE("drawSun", drawSun());
+		phaseStart = recordPhase(PHASE_SUN, phaseStart);
+
+		TRACE_ZONE("drawSnowman", drawSnowman());
+		phaseStart = recordPhase(PHASE_SNOWMAN, phaseStart);
+
+		TRACE_ZONE("drawSnowCover", drawSnowCover());
+
+		//Draw snow if snow is allowed to fall
+		if (shown->snow.count != 0) {
+			TRACE_ZONE("drawSnow", drawSnow());
+		}
+		phaseStart = recordPhase(PHASE_SNOW, phaseStart);
 	}
 
 	if (showDiagnostic) {
-		displayDebug();
+		TRACE_ZONE("displayDebug", displayDebug());
+		phaseStart = recordPhase(PHASE_OVERLAY, phaseStart);
 	}
 
-	glutSwapBuffers();
+	TRACE_ZONE("glutSwapBuffers", glutSwapBuffers());
+	recordPhase(PHASE_SWAP, phaseStart);
+	governDensity(finishFrameTiming());
+	TRACE_END(zone, "display");
 }
 
 /*
@@ -199,6 +317,9 @@ void display(void)
 */
 void reshape(int newWidth, int newHeight)
 {
+	width = newWidth;
+	height = newHeight;
+
 	glViewport(0, 0, newWidth, newHeight);
 
 	// Switch to projection matrix mode
@@ -211,6 +332,14 @@ void reshape(int newWidth, int newHeight)
 	// Switch back to model view matrix mode
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
+
+	// Circle detail depends on the window size.
+	buildSceneGeometry();
+
+	if (config.software && !resizeFramebuffer(&softwareFrame, newWidth, newHeight)) {
+		fprintf(stderr, "Couldn't allocate a %dx%d framebuffer\n", newWidth, newHeight);
+		exit(1);
+	}
 }
 
 /*
@@ -220,12 +349,10 @@ void keyPressed(unsigned char key, int x, int y)
 {
 	switch (tolower(key)) {
 		case KEY_S:
-			snowFall = !snowFall;
+			submitCommand(COMMAND_TOGGLE_SNOW, 0);
 			break;
 		case KEY_JUMP:
-			if (!jumping) {
-				jumping = true;
-			}
+			submitCommand(COMMAND_JUMP, 0);
 			break;
 		case KEY_D:
 			showDiagnostic = !showDiagnostic;
@@ -251,24 +378,19 @@ void keyPressed(unsigned char key, int x, int y)
 */
 void idle(void)
 {
-	// Wait until it's time to render the next frame.
+	TRACE_BEGIN(zone);
 
-	unsigned int frameTimeElapsed = (unsigned int)glutGet(GLUT_ELAPSED_TIME) - frameStartTime;
-	if (frameTimeElapsed < FRAME_TIME)
-	{
-		// This frame took less time to render than the ideal FRAME_TIME: we'll suspend this thread for the remaining time,
-		// so we're not taking up the CPU until we need to render another frame.
-		unsigned int timeLeft = FRAME_TIME - frameTimeElapsed;
-		Sleep(timeLeft);
-	}
+	// Wait until it's time to render the next frame: sleep while the deadline is
+	// far off, then spin for the last fraction of a millisecond.
+	TRACE_ZONE("framePacerWait", framePacerWait(&pacer));
 
 	// Begin processing the next frame.
 
-	frameStartTime = glutGet(GLUT_ELAPSED_TIME); // Record when we started work on the new frame.
-
-	think(); // Update our simulated world before the next call to display().
+	TRACE_ZONE("think", think()); // Update our simulated world before the next call to display().
 
 	glutPostRedisplay(); // Tell OpenGL there's a new frame ready to be drawn.
+
+	TRACE_END(zone, "idle");
 }
 
 /******************************************************************************
@@ -285,41 +407,20 @@ void init(void)
 
 	gluOrtho2D(0.0f, 1.0f, 0.0f, 1.0f);
 
-	srand(time(NULL));  
-
-	// Ground
-	groundVertices[0].x = 0.0f;
-	groundVertices[0].y = 0.200f;
-	groundVertices[1].x = rand() % 100 / 1000.0f + 0.050f;
-	groundVertices[1].y = rand() % 100 / 1000.0f + 0.250f;
-	groundVertices[2].x = 1.0f - rand() % 100 / 1000.0f - 0.050f;
-	groundVertices[2].y = groundVertices[1].y;
-	groundVertices[3].x = 1.0f;
-	groundVertices[3].y = 0.200f;
-
-
-	// Snowman
-	Snowman bottom = { 0.500f, 0.300f, 0.100f, 100, WHITE, GREY };
-	Snowman mid = { 0.500f, 0.420f, 0.080f, 100, WHITE, GREY };
-	Snowman top = { 0.500f, 0.520f, 0.060f, 100, WHITE, GREY };
-	Snowman lEye = { 0.480f, 0.550f, 0.010f, 50, BLACK, BLACK };
-	Snowman rEye = { 0.520f, 0.550f, 0.010f, 50, BLACK, BLACK };
-	Snowman nose = { 0.500f, 0.520f, 0.012f, 7, ORANGE, ORANGE };
-
-	snowman[0] = bottom;
-	snowman[1] = mid;
-	snowman[2] = top;
-	snowman[3] = lEye;
-	snowman[4] = rEye;
-	snowman[5] = nose;
-
-	sun.x = 0.0f;
-	sun.y = 0.7f;
-	sun.colour = YELLOW;
+	startScene(&scene, &config);
+
+	buildSceneGeometry();
+
+	if (config.software && !initFramebuffer(&softwareFrame, width, height)) {
+		fprintf(stderr, "Couldn't allocate a %dx%d framebuffer\n", width, height);
+		exit(1);
+	}
 }
 
 /*
-	Advance our animation by FRAME_TIME milliseconds.
+	Advance our animation to the current time, in fixed ticks, after applying
+	any commands from the control channel. With --pipeline the simulation
+	thread does both; this just picks up its latest snapshot.
 
 	Note: Our template's GLUT idle() callback calls this once before each new
 	frame is drawn, EXCEPT the very first frame drawn after our application
@@ -328,151 +429,119 @@ void init(void)
 */
 void think(void)
 {
-	//Snow
-	if (snowCount < MAX_PARTICLES && snowFall) {
-		createSnow(snowCount);
-		snowCount++;
-	}
-	
-	for (int i = 0; i < snowCount; i++) {
-		snowParticles[i].y -= snowParticles[i].speed;
-		snowParticles[i].x += (rand() % 4 - 1) / 10000.0f;
-		if (snowParticles[i].y < 0.002 && snowFall) {
-			createSnow(i);
-		}
-	}
-
-	if (snowCount != 0 && !snowFall) {
-		for (int i = 0; i < snowCount; i++) {
-			if (snowParticles[i].y < 0.002) {
-				for (int j = i; j < snowCount - 1; j++) {
-					snowParticles[j] = snowParticles[j + 1];
-				}
-				snowCount--;
-			}
-		}
-	}
-
-	//Jumping
-	if (jumping && timeJumping <= JUMP_TIME) {
-		timeJumping++;
-
-		int adjust = timeJumping > JUMP_TIME / 2 ? -1 : 1;
-		float maxHeight = 0.008f;
-		float normalizedTime = (float)timeJumping / JUMP_TIME;
-		
-		//Parabolic jumping height
-		float height = maxHeight * (1 - pow(2 * normalizedTime - 1, 2));
-
-		for (int i = 0; i < 6; i++) {
-			snowman[i].cy += height * adjust;
-		}
-	}
-	else if (timeJumping > JUMP_TIME) {
-		timeJumping = 0;
-		jumping = false;
+	if (controlQuitRequested()) {
+		exit(0);
 	}
 
-	//Sun
-	sun.x += 0.001f;
-
-	//Give the sun an arc
-	if (sun.x < 0.4f) {
-		sun.y += 0.0005f;
-	}
-	else if (sun.x >= 0.4f && sun.x < 0.5f) {
-		sun.y += 0.00005f;
-	}
-	else if (sun.x >= 0.5f && sun.x < 0.6f) {
-		sun.y -= 0.00005f;
+	uint64_t now = timeNowNs();
+	if (config.pipeline) {
+		snapshot = acquireSnapshot();
+		shown = &snapshot->scene;
+		interpolation = snapshotAlpha(snapshot, now);
 	}
 	else {
-		sun.y -= 0.0005f;
-	}
-
-	if (sun.x > 1.1f) {
-		sun.x = -0.f;
-		sun.y = 0.7f;
-		if (dayTime) {
-			sun.colour = WHITE;
-			dayTime = false;
-			skyTop = BLACK;
-			skyBottom = GREY;
-		}
-		else {
-			sun.colour = YELLOW;
-			dayTime = true;
-			skyTop = DARKBLUE;
-			skyBottom = LIGHTBLUE;
-		}
-	}
-
-	if (sun.x > 0.9f && dayTime) {
-		skyTop = fadeColor(skyTop, BLACK);
-		skyBottom = fadeColor(skyBottom, GREY);
-	}
-	
-	if (sun.x > 0.9f && !dayTime) {
-		skyTop = fadeColor(skyTop, DARKBLUE);
-		skyBottom = fadeColor(skyBottom, LIGHTBLUE);
+		applyControlCommands(&scene);
+		interpolation = advanceScene(&scene, now - lastThinkTime);
 	}
+	lastThinkTime = now;
+	recordPhase(PHASE_THINK, now);
 }
 
-Colour fadeColor(Colour start, Colour end) {
-	Colour result;
-	result.r = start.r + ((end.r - start.r) / 50);
-	result.g = start.g + ((end.g - start.g) / 50);
-	result.b = start.b + ((end.b - start.b) / 50);
-	return result;
+void setColour(int r, int g, int b, float a) {
+	glColor4f(r / 255.0f, g / 255.0f, b / 255.0f, a);
 }
 
-void createSnow(int i) {
-	snowParticles[i].x = rand() % 1000 / 1000.0f + 0.02f;
-	snowParticles[i].y = 1.0f;
-	snowParticles[i].size = rand() % 5 / 1.0f + 2;
-	snowParticles[i].speed = snowParticles[i].size / 10000.0f + 0.0002f;
-	snowParticles[i].transparency = rand() % 10 / 10.0f + 0.1f;
-}
+/*
+	(Re)build the display lists for the ground, snowman and sun. Called once the
+	scene exists and again whenever the window size changes the circle detail.
+*/
+void buildSceneGeometry(void) {
+	if (groundList == 0) {
+		groundList = glGenLists(3);
+		snowmanList = groundList + 1;
+		sunList = groundList + 2;
+	}
 
-void static setColour(int r, int g, int b, float a) {
-	glColor4f(r / 255.0f, g / 255.0f, b / 255.0f, a);
-}
+	glNewList(groundList, GL_COMPILE);
+	glBegin(GL_POLYGON);
+	setColour(255, 250, 253, 1.0f);
+	glVertex2f(1.0, 0.0);
+	glVertex2f(0.0, 0.0);
 
-void drawBackground(void) {
-	//Draw the sky
+	setColour(167, 191, 219, 1.0f);
+	glVertex2f(shown->groundVertices[0].x, shown->groundVertices[0].y);
+	glVertex2f(shown->groundVertices[1].x, shown->groundVertices[1].y);
+	glVertex2f(shown->groundVertices[2].x, shown->groundVertices[2].y);
+	glVertex2f(shown->groundVertices[3].x, shown->groundVertices[3].y);
 
-	Colour top;
-	Colour bottom;
+	glEnd();
+	glEndList();
 
-	glBegin(GL_POLYGON);
+	glNewList(snowmanList, GL_COMPILE);
+	for (int i = 0; i < 6; i++) {
+		const Snowman *part = &shown->snowman[i];
+		drawCircle(part->cx, part->cy, part->r, part->segments, part->inner, part->outer);
+	}
+	glEndList();
 
-	setColour(skyBottom.r, skyBottom.g, skyBottom.b, 1.0f);
+	// No colour here: it is set before the list is called.
+	int sunSegments = circleSegments(0.1f * (width > height ? width : height));
+	const Point *ring = unitCircle(&sunSegments);
+	glNewList(sunList, GL_COMPILE);
+	glBegin(GL_TRIANGLE_FAN);
 	glVertex2f(0.0f, 0.0f);
-	glVertex2f(1.0f, 0.0f);
+	for (int i = 0; ring != NULL && i <= sunSegments; i++) {
+		glVertex2f(ring[i].x, ring[i].y);
+	}
+	glEnd();
+	glEndList();
+}
 
-	setColour(skyTop.r, skyTop.g, skyTop.b, 0.9f);
-	glVertex2f(1.0f, 1.0f);
-	glVertex2f(0.0f, 1.0f);
+void drawBackground(void) {
+	//Draw the sky
+	for (int i = 0; i < 4; i++) {
+		Colour colour = i < 2 ? sceneView.skyBottom : sceneView.skyTop;
+		skyColours[i][0] = colour.r / 255.0f;
+		skyColours[i][1] = colour.g / 255.0f;
+		skyColours[i][2] = colour.b / 255.0f;
+		skyColours[i][3] = i < 2 ? 1.0f : 0.9f;
+	}
 
-	glEnd();
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer(2, GL_FLOAT, 0, skyVertices);
+	glColorPointer(4, GL_FLOAT, 0, skyColours);
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
 
 	//Draw the ground
-	glBegin(GL_POLYGON);
-	setColour(255, 250, 253, 1.0f);
-	glVertex2f(1.0, 0.0);
-	glVertex2f(0.0, 0.0);
+	glCallList(groundList);
+}
 
-	setColour(167, 191, 219, 1.0f);
-	glVertex2f(groundVertices[0].x, groundVertices[0].y);
-	glVertex2f(groundVertices[1].x, groundVertices[1].y);
-	glVertex2f(groundVertices[2].x, groundVertices[2].y);
-	glVertex2f(groundVertices[3].x, groundVertices[3].y);
+void drawSun(void) {
+	setColour(sceneView.sun.colour.r, sceneView.sun.colour.g, sceneView.sun.colour.b, 1.0f);
 
-	glEnd();
+	glPushMatrix();
+	glTranslatef(sceneView.sun.x, sceneView.sun.y, 0.0f);
+	glScalef(0.1f, 0.1f, 1.0f);
+	glCallList(sunList);
+	glPopMatrix();
 }
 
+/*
+	Draw a filled circle as a triangle fan from a cached unit ring. With
+	CIRCLE_AUTO_SEGMENTS the segment count follows the circle's size in pixels.
+*/
 void drawCircle(float cx, float cy, float r, int numSegments, Colour inner, Colour outer) {
-	float angleIncrement = 2.0f * M_PI / (float)numSegments;
+	if (numSegments == CIRCLE_AUTO_SEGMENTS) {
+		// The scene is stretched to fill the window, so size for the longer side.
+		numSegments = circleSegments(r * (width > height ? width : height));
+	}
+	const Point *ring = unitCircle(&numSegments);
+	if (ring == NULL) {
+		return;
+	}
 
 	glBegin(GL_TRIANGLE_FAN);
 	setColour(inner.r, inner.g, inner.b, 1.0f);
@@ -480,38 +549,148 @@ void drawCircle(float cx, float cy, float r, int numSegments, Colour inner, Colo
 
 	setColour(outer.r, outer.g, outer.b, 1.0f);
 	for (int i = 0; i <= numSegments; i++) {
-		float angle = i * angleIncrement;
-		float x = cx + r * cosf(angle);
-		float y = cy + r * sinf(angle);
-		glVertex2f(x, y);
+		glVertex2f(cx + r * ring[i].x, cy + r * ring[i].y);
 	}
 	glEnd();
 }
 
+/*
+	Draw the flakes as client-side vertex arrays, one glDrawArrays() per point
+	size. The particles are bucketed by size with a counting sort into
+	snowVertices, which only ever grows.
+*/
 void drawSnow(void) {
-	for (int i = 0; i < snowCount; i++) {
-		setColour(255, 255, 255, snowParticles[i].transparency);
-		glPointSize(snowParticles[i].size);
-		glBegin(GL_POINTS);
-		glVertex2f(snowParticles[i].x, snowParticles[i].y);
-		glEnd();
+	const ParticleStore *snow = &shown->snow;
+
+	if (snow->count > snowVertexCapacity) {
+		SnowVertex *grown = realloc(snowVertices, (size_t)snow->capacity * sizeof(SnowVertex));
+		if (grown == NULL) {
+			return;
+		}
+		snowVertices = grown;
+		snowVertexCapacity = snow->capacity;
+	}
+
+	int bucketCount[SNOW_SIZES] = { 0 };
+	for (int i = 0; i < snow->count; i++) {
+		bucketCount[flakeSize(snow->size[i]) - SNOW_MIN_SIZE]++;
 	}
+
+	int bucketStart[SNOW_SIZES];
+	int bucketNext[SNOW_SIZES];
+	int start = 0;
+	for (int b = 0; b < SNOW_SIZES; b++) {
+		bucketStart[b] = bucketNext[b] = start;
+		start += bucketCount[b];
+	}
+
+	for (int i = 0; i < snow->count; i++) {
+		SnowVertex *vertex = &snowVertices[bucketNext[flakeSize(snow->size[i]) - SNOW_MIN_SIZE]++];
+		vertex->x = snow->x[i];
+		vertex->y = snow->y[i] + snow->speed[i] * sceneView.snowRise;
+		vertex->colour[0] = vertex->colour[1] = vertex->colour[2] = 255;
+		vertex->colour[3] = (GLubyte)flakeAlpha(snow->transparency[i]);
+	}
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer(2, GL_FLOAT, sizeof(SnowVertex), &snowVertices[0].x);
+	glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(SnowVertex), snowVertices[0].colour);
+
+	for (int b = 0; b < SNOW_SIZES; b++) {
+		if (bucketCount[b] > 0) {
+			glPointSize((GLfloat)(b + SNOW_MIN_SIZE));
+			glDrawArrays(GL_POINTS, bucketStart[b], bucketCount[b]);
+		}
+	}
+
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+/*
+	Draw the snow lying on the ground and the snowman, one quad per column
+	that has any. Snow on the snowman is raised with it.
+*/
+void drawSnowCover(void) {
+	const SnowCover *cover = &shown->cover;
+	int vertexCount = 0;
+
+	for (int column = 0; column < SNOW_COLUMNS; column++) {
+		if (cover->depth[column] <= 0.0f) {
+			continue;
+		}
+		bool lifted = column >= cover->liftBegin && column < cover->liftEnd;
+		GLfloat left = (GLfloat)column / SNOW_COLUMNS;
+		GLfloat right = (GLfloat)(column + 1) / SNOW_COLUMNS;
+		GLfloat bottom = cover->base[column] + (lifted ? sceneView.snowmanOffset : 0.0f);
+		GLfloat top = bottom + cover->depth[column];
+
+		GLfloat (*quad)[2] = &coverVertices[vertexCount];
+		quad[0][0] = left;  quad[0][1] = bottom;
+		quad[1][0] = right; quad[1][1] = bottom;
+		quad[2][0] = right; quad[2][1] = top;
+		quad[3][0] = left;  quad[3][1] = top;
+		vertexCount += 4;
+	}
+	if (vertexCount == 0) {
+		return;
+	}
+
+	setColour(WHITE.r, WHITE.g, WHITE.b, 1.0f);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(2, GL_FLOAT, 0, coverVertices);
+	glDrawArrays(GL_QUADS, 0, vertexCount);
+	glDisableClientState(GL_VERTEX_ARRAY);
 }
 
 void drawSnowman(void) {
-	drawCircle(snowman[0].cx, snowman[0].cy, snowman[0].r, snowman[0].segments, snowman[0].inner, snowman[0].outer);
-	drawCircle(snowman[1].cx, snowman[1].cy, snowman[1].r, snowman[1].segments, snowman[1].inner, snowman[1].outer);
-	drawCircle(snowman[2].cx, snowman[2].cy, snowman[2].r, snowman[2].segments, snowman[2].inner, snowman[2].outer);
-	drawCircle(snowman[3].cx, snowman[3].cy, snowman[3].r, snowman[3].segments, snowman[3].inner, snowman[3].outer);
-	drawCircle(snowman[4].cx, snowman[4].cy, snowman[4].r, snowman[4].segments, snowman[4].inner, snowman[4].outer);
-	drawCircle(snowman[5].cx, snowman[5].cy, snowman[5].r, snowman[5].segments, snowman[5].inner, snowman[5].outer);
+	// A jump only moves the whole snowman.
+	glPushMatrix();
+	glTranslatef(0.0f, sceneView.snowmanOffset, 0.0f);
+	glCallList(snowmanList);
+	glPopMatrix();
 }
 
 void displayDebug(void) {
-	char infoString[200];
-	sprintf_s(infoString, sizeof(infoString), "Diagnostics:\n particles: %d of %d\nScene controls:\n s: toggle snow\n q: quit\n d: toggle diagnostic\n space: jump", snowCount, MAX_PARTICLES);
+	char infoString[1024];
+	int length = snprintf(infoString, sizeof(infoString), "Diagnostics:\n particles: %d of %d\n pacing: %d fps, %.3f ms late (worst %.3f), %u missed\n",
+		shown->snow.count, shown->particleBudget, config.fps, pacer.meanError / 1e6, pacer.worstError / 1e6, pacer.missed);
+
+	if (++framesSinceSummary >= TIMING_REFRESH) {
+		summariseTimings(timingSummary);
+		framesSinceSummary = 0;
+	}
+	length += snprintf(infoString + length, sizeof(infoString) - length, " ms p50 / p95 / p99 / worst:\n");
+	for (int phase = 0; phase < PHASE_COUNT; phase++) {
+		const PhaseSummary *summary = &timingSummary[phase];
+		// Skip the phases this renderer doesn't have.
+		if (summary->worst == 0 || length >= (int)sizeof(infoString)) {
+			continue;
+		}
+		length += snprintf(infoString + length, sizeof(infoString) - length, "  %s: %.2f / %.2f / %.2f / %.2f\n",
+			phaseNames[phase], summary->p50 / 1e6, summary->p95 / 1e6, summary->p99 / 1e6, summary->worst / 1e6);
+	}
+	if (length < (int)sizeof(infoString)) {
+		if (config.pipeline) {
+			length += snprintf(infoString + length, sizeof(infoString) - length, " pipeline: simulation busy %.0f%% of the time\n",
+				snapshot->simLoad * 100.0f);
+		}
+	}
+	if (length < (int)sizeof(infoString)) {
+		if (config.fixedDensity) {
+			length += snprintf(infoString + length, sizeof(infoString) - length, " governor: off\n");
+		}
+		else {
+			length += snprintf(infoString + length, sizeof(infoString) - length, " governor: level %d of %d (%.0f%% density), load %.0f%%, %u changes\n",
+				governor.level, GOVERNOR_LEVELS - 1, governorScale(&governor) * 100.0, governor.load * 100.0, governor.changes);
+		}
+	}
+	if (length < (int)sizeof(infoString)) {
+		snprintf(infoString + length, sizeof(infoString) - length, "Scene controls:\n s: toggle snow\n q: quit\n d: toggle diagnostic\n space: jump");
+	}
 
-	if (dayTime) {
+	if (shown->dayTime) {
 		setColour(0, 0, 0, 1.0f);
 	}
 	else {
@@ -519,7 +698,70 @@ void displayDebug(void) {
 	}
 
 	glRasterPos2f(0.02f, 0.95f);
-	glutBitmapString(GLUT_BITMAP_HELVETICA_12, infoString);
+	glutBitmapString(GLUT_BITMAP_HELVETICA_12, (const unsigned char *)infoString);
+}
+
+/*
+	Carry out a command on the scene now or, with --pipeline, hand it to the
+	simulation thread.
+*/
+void submitCommand(CommandType type, int value) {
+	Command command = { type, value, 0.0f };
+	if (!config.pipeline) {
+		applyCommand(&scene, command);
+	}
+	else if (!submitPipelineCommand(command)) {
+		fprintf(stderr, "Command queue full, dropped a command\n");
+	}
+}
+
+/*
+	Feed the frame's busy time to the governor and apply any new level to the
+	particle budget. The swap is left out, since it can block on the display's
+	refresh rather than on work; the pacer's wait falls outside every phase.
+	With --pipeline the frame costs whichever is busier, this thread or the
+	simulation's.
+*/
+void governDensity(const FrameTiming *frame) {
+	if (config.fixedDensity) {
+		return;
+	}
+
+	uint64_t busy = 0;
+	for (int phase = 0; phase < PHASE_COUNT; phase++) {
+		if (phase != PHASE_SWAP && phase != PHASE_FRAME) {
+			busy += frame->ns[phase];
+		}
+	}
+	if (config.pipeline) {
+		uint64_t simBusy = (uint64_t)(snapshot->simLoad * pacer.period);
+		busy = simBusy > busy ? simBusy : busy;
+	}
+	if (!governFrame(&governor, busy)) {
+		return;
+	}
+
+	// The scene applies the scale to whatever budget was last asked for.
+	submitCommand(COMMAND_SCALE_BUDGET, (int)(governorScale(&governor) * BUDGET_SCALE + 0.5));
+}
+
+void saveTimings(void) {
+	writeTimings(config.timings);
+}
+
+void saveTrace(void) {
+	writeTrace(config.trace);
+}
+
+void saveRecording(void) {
+	stopRecording(scene.frame);
+}
+
+void saveScene(void) {
+	// Nothing to save if we're leaving before the scene was set up.
+	if (scene.snow.block != NULL) {
+		saveCheckpoint(&scene, config.checkpoint);
+	}
 }
 
 /******************************************************************************/
\ No newline at end of file
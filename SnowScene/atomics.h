@@ -0,0 +1,114 @@
+/******************************************************************************
+ *
+ * Atomic operations
+ *
+ * The handful of atomics shared between threads, mapped onto the Interlocked
+ * API on MSVC and the __atomic builtins elsewhere. Loads acquire and stores
+ * release; read-modify-write operations are sequentially consistent.
+ *
+ ******************************************************************************/
+
+#ifndef ATOMICS_H
+#define ATOMICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+
+// On x86/x64 plain aligned loads and stores already have acquire/release
+// ordering; the barrier only stops the compiler from reordering around them.
+static inline int32_t atomicLoad32(volatile int32_t *p)
+{
+	int32_t value = *p;
+	_ReadWriteBarrier();
+	return value;
+}
+
+static inline void atomicStore32(volatile int32_t *p, int32_t value)
+{
+	_ReadWriteBarrier();
+	*p = value;
+}
+
+static inline int64_t atomicLoad64(volatile int64_t *p)
+{
+#ifdef _M_X64
+	int64_t value = *p;
+	_ReadWriteBarrier();
+	return value;
+#else
+	return _InterlockedCompareExchange64(p, 0, 0);
+#endif
+}
+
+static inline void atomicStore64(volatile int64_t *p, int64_t value)
+{
+#ifdef _M_X64
+	_ReadWriteBarrier();
+	*p = value;
+#else
+	_InterlockedExchange64(p, value);
+#endif
+}
+
+// Adds value and returns what was there before.
+static inline int32_t atomicAdd32(volatile int32_t *p, int32_t value)
+{
+	return _InterlockedExchangeAdd((volatile long *)p, value);
+}
+
+// Stores value and returns what was there before.
+static inline int32_t atomicExchange32(volatile int32_t *p, int32_t value)
+{
+	return _InterlockedExchange((volatile long *)p, value);
+}
+
+static inline bool atomicCas64(volatile int64_t *p, int64_t expected, int64_t desired)
+{
+	return _InterlockedCompareExchange64(p, desired, expected) == expected;
+}
+
+#else
+
+static inline int32_t atomicLoad32(volatile int32_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomicStore32(volatile int32_t *p, int32_t value)
+{
+	__atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static inline int64_t atomicLoad64(volatile int64_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomicStore64(volatile int64_t *p, int64_t value)
+{
+	__atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+// Adds value and returns what was there before.
+static inline int32_t atomicAdd32(volatile int32_t *p, int32_t value)
+{
+	return __atomic_fetch_add(p, value, __ATOMIC_SEQ_CST);
+}
+
+// Stores value and returns what was there before.
+static inline int32_t atomicExchange32(volatile int32_t *p, int32_t value)
+{
+	return __atomic_exchange_n(p, value, __ATOMIC_SEQ_CST);
+}
+
+static inline bool atomicCas64(volatile int64_t *p, int64_t expected, int64_t desired)
+{
+	return __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#endif
+
+#endif
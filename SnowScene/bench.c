@@ -0,0 +1,445 @@
+/******************************************************************************
+ *
+ * Microbenchmarks
+ *
+ * Times the simulation and geometry kernels in isolation, at particle counts
+ * from the kiosk's 1500 up to 10 million. Each result is one JSON object per
+ * line on stdout, so runs on different commits can be diffed or loaded into a
+ * spreadsheet; progress and machine details go to stderr.
+ *
+ *   SnowSceneBench [--threads N] [--max-particles N] [--min-ms N] [--seed N]
+ *
+ ******************************************************************************/
+
+#include "config.h"
+#include "geometry.h"
+#include "jobs.h"
+#include "particles.h"
+#include "platform.h"
+#include "rng.h"
+#include "scene.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Particle counts benchmarked, up to --max-particles.
+static const int particleCounts[] = { 1500, 15000, 150000, 1500000, 10000000 };
+#define PARTICLE_COUNTS (int)(sizeof(particleCounts) / sizeof(particleCounts[0]))
+
+// Circle sizes (radius in pixels) for the tessellation benchmark.
+static const float circleRadii[] = { 10.0f, 100.0f, 1000.0f };
+#define CIRCLE_RADII (int)(sizeof(circleRadii) / sizeof(circleRadii[0]))
+
+// Each benchmark repeats until it has run for at least this long, and at least this often.
+#define DEFAULT_MIN_MS 200
+#define MIN_RUNS 5
+#define MAX_RUNS 10000
+
+// A flake is x, y, speed, size and transparency.
+#define PARTICLE_BYTES (5 * (int)sizeof(float))
+
+typedef struct {
+	Scene scene;
+	int particles;
+	int *indices; // for the removal benchmarks
+	int indexCount;
+	Point *vertices; // for the tessellation benchmark
+	float radius;
+	uint32_t seed;
+	uint64_t steps;  // ticks stepped since the last fillSnow()
+	uint64_t landed; // flakes that landed in them
+} Bench;
+
+typedef struct {
+	const char *name;
+	void (*setup)(Bench *b); // untimed, before every run (may be NULL)
+	void (*run)(Bench *b);
+	double (*ops)(const Bench *b);
+	double (*bytes)(const Bench *b); // memory moved per op, by the kernel's own accounting
+} Benchmark;
+
+// Results are written here so the compiler can't drop the work.
+static volatile float sink;
+
+static int minMs = DEFAULT_MIN_MS;
+static uint64_t runNs[MAX_RUNS];
+
+/******************************************************************************
+ * Set-up
+ ******************************************************************************/
+
+/*
+	A scene with b->particles flakes spread over the whole sky, as it looks once
+	the snow has been falling for a while.
+*/
+static void fillSnow(Bench *b)
+{
+	Scene *s = &b->scene;
+	ParticleStore *snow = &s->snow;
+	spawnParticles(snow, 0, b->particles, rngKey(b->seed, RNG_SPAWN, 0));
+	for (int i = 0; i < b->particles; i++) {
+		snow->y[i] = rngAt(rngKey(b->seed, RNG_GROUND, 1), (uint32_t)i) % 1000 / 1000.0f;
+	}
+	snow->count = b->particles;
+	s->particleBudget = b->particles;
+	s->snowFall = true;
+	b->steps = 0;
+	b->landed = 0;
+}
+
+static bool initBench(Bench *b, int particles)
+{
+	Config c = config;
+	c.particles = particles;
+	c.capacity = particles;
+	c.seed = (int)b->seed;
+
+	memset(&b->scene, 0, sizeof(b->scene));
+	initScene(&b->scene, &c);
+	b->particles = particles;
+	b->indices = malloc((size_t)particles * sizeof(int));
+	if (b->indices == NULL) {
+		return false;
+	}
+	fillSnow(b);
+	return true;
+}
+
+static void freeBench(Bench *b)
+{
+	freeParticles(&b->scene.snow);
+	free(b->indices);
+	b->indices = NULL;
+}
+
+/******************************************************************************
+ * Particle benchmarks (per flake)
+ ******************************************************************************/
+
+static double perParticle(const Bench *b)
+{
+	return b->particles;
+}
+
+// think()'s particle pass alone: fall, wind and the landed list. Nothing
+// respawns here, so every run starts from a freshly spread field of flakes.
+static void runFall(Bench *b)
+{
+	fallParticles(&b->scene.snow, &b->scene.wind, 1.0f, b->scene.cover.surface);
+}
+
+static double fallBytes(const Bench *b)
+{
+	(void)b;
+	return 2 * sizeof(float) * 2 + sizeof(float); // x and y read and written, speed read
+}
+
+// A whole tick with snow falling: fall, then respawn whatever landed.
+static void runStep(Bench *b)
+{
+	stepScene(&b->scene);
+	b->steps++;
+	b->landed += (uint64_t)b->scene.landedCount;
+}
+
+/*
+	The fall, plus per landed flake its index written and read back, its x and
+	size read to settle it and a new flake written over it, plus the rows of
+	the next wind field built each tick (front nodes read, next nodes and
+	cells written) shared out over the flakes.
+*/
+static double stepBytes(const Bench *b)
+{
+	double landed = b->steps > 0 ? (double)b->landed / b->steps : 0.0;
+	double landedBytes = 2 * sizeof(int) + 2 * sizeof(float) + PARTICLE_BYTES;
+	double windBytes = (double)WIND_ROWS_PER_TICK * (WIND_NODES * 4 * sizeof(float) + WIND_CELLS * WIND_CELL_FLOATS * sizeof(float));
+	return fallBytes(b) + (landed * landedBytes + windBytes) / b->particles;
+}
+
+static void runSpawn(Bench *b)
+{
+	Scene *s = &b->scene;
+	spawnParticles(&s->snow, 0, b->particles, rngKey(b->seed, RNG_SPAWN, s->frame++));
+}
+
+static double spawnBytes(const Bench *b)
+{
+	(void)b;
+	return PARTICLE_BYTES;
+}
+
+/******************************************************************************
+ * Removal benchmarks (per flake removed)
+ ******************************************************************************/
+
+// Once the snow stops, landed flakes are retired a few at a time. Remove every
+// 64th flake, as a heavy frame of that would.
+#define RETIRE_STRIDE 64
+
+static void setupRetire(Bench *b)
+{
+	fillSnow(b);
+	b->indexCount = 0;
+	for (int i = 0; i < b->particles; i += RETIRE_STRIDE) {
+		b->indices[b->indexCount++] = i;
+	}
+}
+
+static void runRetire(Bench *b)
+{
+	retireParticles(&b->scene.snow, b->indices, b->indexCount, false);
+}
+
+static void runRetireStable(Bench *b)
+{
+	retireParticles(&b->scene.snow, b->indices, b->indexCount, true);
+}
+
+static double retireOps(const Bench *b)
+{
+	return (b->particles + RETIRE_STRIDE - 1) / RETIRE_STRIDE;
+}
+
+// Each hole is filled with the last flake: one flake read and one written.
+static double retireBytes(const Bench *b)
+{
+	(void)b;
+	return 2 * PARTICLE_BYTES;
+}
+
+// Everything after the first hole slides down: the whole store, once, per removal.
+static double retireStableBytes(const Bench *b)
+{
+	return 2.0 * PARTICLE_BYTES * b->particles / retireOps(b);
+}
+
+/******************************************************************************
+ * Scene benchmarks (per call)
+ ******************************************************************************/
+
+#define CALLS_PER_RUN 100000
+
+static double perCall(const Bench *b)
+{
+	(void)b;
+	return CALLS_PER_RUN;
+}
+
+static double noBytes(const Bench *b)
+{
+	(void)b;
+	return 0.0;
+}
+
+static void runFade(Bench *b)
+{
+	(void)b;
+	// Swap targets like day and night do, so the colour never decays into denormals.
+	Colour colour = DARKBLUE;
+	for (int i = 0; i < CALLS_PER_RUN; i++) {
+		colour = fadeColor(colour, i & 64 ? BLACK : DARKBLUE, 0.02f);
+	}
+	sink = colour.r + colour.g + colour.b;
+}
+
+// The sun and sky at a time of day, spread over the whole cycle.
+static void runSky(Bench *b)
+{
+	(void)b;
+	float sum = 0.0f;
+	for (int i = 0; i < CALLS_PER_RUN; i++) {
+		Daylight daylight = daylightAt(i * (1.0f / CALLS_PER_RUN));
+		sum += daylight.sun.x + daylight.skyTop.r;
+	}
+	sink = sum;
+}
+
+// Jumping to a time of day, as the control channel's "time T" does.
+static void runSeek(Bench *b)
+{
+	for (int i = 0; i < CALLS_PER_RUN; i++) {
+		setTimeOfDay(&b->scene, i * (1.0f / CALLS_PER_RUN));
+	}
+	sink = b->scene.sun.x;
+}
+
+/*
+	What drawCircle() does short of GL: pick the segment count for the size on
+	screen, look up the ring and emit the scaled fan. One op is one vertex.
+*/
+static void runCircle(Bench *b)
+{
+	int segments = 0;
+	for (int i = 0; i < CALLS_PER_RUN / 100; i++) {
+		segments = circleSegments(b->radius);
+		const Point *ring = unitCircle(&segments);
+		float r = b->radius / 1000.0f;
+		b->vertices[0].x = 0.5f;
+		b->vertices[0].y = 0.5f;
+		for (int k = 0; k <= segments; k++) {
+			b->vertices[k + 1].x = 0.5f + r * ring[k].x;
+			b->vertices[k + 1].y = 0.5f + r * ring[k].y;
+		}
+	}
+	sink = b->vertices[segments / 2].x;
+}
+
+static double circleOps(const Bench *b)
+{
+	return (double)(CALLS_PER_RUN / 100) * (circleSegments(b->radius) + 2);
+}
+
+static double circleBytes(const Bench *b)
+{
+	(void)b;
+	return sizeof(Point) * 2; // ring point read, vertex written
+}
+
+/******************************************************************************
+ * Runner
+ ******************************************************************************/
+
+static int compareNs(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+	Run one benchmark until it has had minMs of run time (and MIN_RUNS runs)
+	and print its median and best time per op.
+*/
+static void measure(const Benchmark *bench, Bench *b, const char *sizeKey, double size)
+{
+	int runs = 0;
+	uint64_t total = 0;
+	while (runs < MAX_RUNS && (runs < MIN_RUNS || total < (uint64_t)minMs * 1000000)) {
+		if (bench->setup != NULL) {
+			bench->setup(b);
+		}
+		uint64_t start = timeNowNs();
+		bench->run(b);
+		runNs[runs] = timeNowNs() - start;
+		total += runNs[runs];
+		runs++;
+	}
+	qsort(runNs, (size_t)runs, sizeof(uint64_t), compareNs);
+
+	double ops = bench->ops(b);
+	double median = runNs[runs / 2] / ops;
+	double best = runNs[0] / ops;
+	double bytes = bench->bytes(b);
+	printf("{\"bench\": \"%s\", \"%s\": %.0f, \"threads\": %d, \"runs\": %d, \"ns_per_op\": %.4f, \"best_ns_per_op\": %.4f, \"bytes_per_op\": %.1f, \"gb_per_s\": %.3f}\n",
+		bench->name, sizeKey, size, jobThreads(), runs, median, best, bytes, bytes / median);
+	fflush(stdout);
+}
+
+static bool parseCount(const char *text, int minimum, int *value)
+{
+	char *end;
+	errno = 0;
+	long parsed = text != NULL ? strtol(text, &end, 10) : 0;
+	if (text == NULL || end == text || *end != '\0' || errno != 0 || parsed < minimum || parsed > INT_MAX) {
+		return false;
+	}
+	*value = (int)parsed;
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int threads = 1;
+	int maxParticles = particleCounts[PARTICLE_COUNTS - 1];
+	int seed = 1;
+	for (int i = 1; i < argc; i += 2) {
+		bool ok = false;
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (strcmp(argv[i], "--threads") == 0) {
+			ok = parseCount(value, 0, &threads);
+		}
+		else if (strcmp(argv[i], "--max-particles") == 0) {
+			ok = parseCount(value, 1, &maxParticles);
+		}
+		else if (strcmp(argv[i], "--min-ms") == 0) {
+			ok = parseCount(value, 1, &minMs);
+		}
+		else if (strcmp(argv[i], "--seed") == 0) {
+			ok = parseCount(value, 1, &seed);
+		}
+		if (!ok) {
+			fprintf(stderr, "Usage: %s [--threads N] [--max-particles N] [--min-ms N] [--seed N]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (!initJobs(threads)) {
+		fprintf(stderr, "Couldn't start %d worker threads\n", threads);
+		return 1;
+	}
+#if defined(SIMD_AVX2)
+	const char *simd = "AVX2";
+#elif defined(SIMD_SSE2)
+	const char *simd = "SSE2";
+#else
+	const char *simd = "none";
+#endif
+	fprintf(stderr, "%d thread(s), %d logical processors, SIMD: %s\n", jobThreads(), cpuCount(), simd);
+
+	static const Benchmark particleBenchmarks[] = {
+		{ "fall", fillSnow, runFall, perParticle, fallBytes },
+		{ "step", NULL, runStep, perParticle, stepBytes },
+		{ "spawn", NULL, runSpawn, perParticle, spawnBytes },
+		{ "retire", setupRetire, runRetire, retireOps, retireBytes },
+		{ "retire-stable", setupRetire, runRetireStable, retireOps, retireStableBytes },
+	};
+	static const Benchmark sceneBenchmarks[] = {
+		{ "fade", NULL, runFade, perCall, noBytes },
+		{ "sky", NULL, runSky, perCall, noBytes },
+		{ "seek", NULL, runSeek, perCall, noBytes },
+	};
+	static const Benchmark circleBenchmark = { "circle", NULL, runCircle, circleOps, circleBytes };
+
+	Bench b;
+	memset(&b, 0, sizeof(b));
+	b.seed = (uint32_t)seed;
+
+	for (int c = 0; c < PARTICLE_COUNTS && particleCounts[c] <= maxParticles; c++) {
+		fprintf(stderr, "%d particles...\n", particleCounts[c]);
+		if (!initBench(&b, particleCounts[c])) {
+			fprintf(stderr, "Out of memory for %d particles\n", particleCounts[c]);
+			return 1;
+		}
+		for (int i = 0; i < (int)(sizeof(particleBenchmarks) / sizeof(particleBenchmarks[0])); i++) {
+			// Every benchmark starts from the same full sky.
+			fillSnow(&b);
+			measure(&particleBenchmarks[i], &b, "particles", b.particles);
+		}
+		freeBench(&b);
+	}
+
+	// The rest don't depend on the particle count.
+	if (!initBench(&b, 1)) {
+		return 1;
+	}
+	for (int i = 0; i < (int)(sizeof(sceneBenchmarks) / sizeof(sceneBenchmarks[0])); i++) {
+		measure(&sceneBenchmarks[i], &b, "particles", 0);
+	}
+
+	b.vertices = malloc((CIRCLE_MAX_SEGMENTS + 2) * sizeof(Point));
+	if (b.vertices == NULL) {
+		return 1;
+	}
+	for (int i = 0; i < CIRCLE_RADII; i++) {
+		b.radius = circleRadii[i];
+		measure(&circleBenchmark, &b, "radius_px", b.radius);
+	}
+	free(b.vertices);
+	freeBench(&b);
+
+	shutdownJobs();
+	return 0;
+}
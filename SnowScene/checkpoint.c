@@ -0,0 +1,237 @@
+/******************************************************************************
+ *
+ * Scene checkpoints
+ *
+ ******************************************************************************/
+
+#include "checkpoint.h"
+#include "platform.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	char magic[8];           // "SNOWCKPT"
+	uint32_t version;
+	uint32_t stateBytes;     // sizeof(CheckpointState), to catch a different layout
+	uint64_t particleOffset; // where the particle arrays start
+	uint64_t particleBytes;  // particleLayoutBytes(capacity)
+	int32_t capacity;
+	int32_t count;
+} CheckpointHeader;
+
+typedef struct {
+	Point groundVertices[4];
+	Snowman snowman[6];
+	SnowCover cover;
+	Wind wind;
+	float snowmanOffset;
+	float timeJumping;
+	float timeOfDay;
+	float spawnCredit;
+	int32_t particleBudget;
+	int32_t baseBudget;
+	int32_t budgetScale;
+	uint32_t seed;
+	uint32_t frame;
+	uint8_t snowFall;
+	uint8_t jumping;
+	uint8_t prefilled;
+} CheckpointState;
+
+/*
+	Wind times further out than this (over half a year at 60 Hz) are refused:
+	the noise lattice index worked out from them would overflow.
+*/
+#define CHECKPOINT_MAX_FRAMES 1e9f
+
+static bool allFinite(const float *values, int count)
+{
+	for (int i = 0; i < count; i++) {
+		if (!isfinite(values[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool finiteColour(Colour c)
+{
+	return isfinite(c.r) && isfinite(c.g) && isfinite(c.b);
+}
+
+// False for NaN too.
+static bool windTime(float frames)
+{
+	return frames >= 0.0f && frames <= CHECKPOINT_MAX_FRAMES;
+}
+
+/*
+	Whether the state outside the flakes could have come from a run, as far as
+	the code using it cares: indices in range and every float finite.
+*/
+static bool validState(const CheckpointState *state)
+{
+	const SnowCover *cover = &state->cover;
+	const Wind *wind = &state->wind;
+	for (int k = 0; k < 2; k++) {
+		if (!allFinite(wind->u[k], WIND_NODES * WIND_NODES) || !allFinite(wind->v[k], WIND_NODES * WIND_NODES)
+			|| !allFinite(wind->cells[k], WIND_CELLS * WIND_CELLS * WIND_CELL_FLOATS)) {
+			return false;
+		}
+	}
+	for (int i = 0; i < 6; i++) {
+		const Snowman *part = &state->snowman[i];
+		if (!isfinite(part->cx) || !isfinite(part->cy) || !isfinite(part->r)
+			|| !finiteColour(part->inner) || !finiteColour(part->outer)) {
+			return false;
+		}
+	}
+	for (int i = 0; i < 4; i++) {
+		if (!isfinite(state->groundVertices[i].x) || !isfinite(state->groundVertices[i].y)) {
+			return false;
+		}
+	}
+	return allFinite(cover->base, SNOW_COLUMNS) && allFinite(cover->depth, SNOW_COLUMNS)
+		&& allFinite(cover->surface, SNOW_COLUMNS) && isfinite(cover->lift)
+		&& cover->liftBegin >= 0 && cover->liftBegin <= cover->liftEnd && cover->liftEnd <= SNOW_COLUMNS
+		&& (wind->front == 0 || wind->front == 1)
+		&& wind->nextRow >= 0 && wind->nextRow < WIND_NODES
+		&& allFinite(wind->layer, WIND_NOISE_POINTS) && isfinite(wind->breeze)
+		&& windTime(wind->time) && windTime(wind->buildTime)
+		&& isfinite(state->snowmanOffset) && isfinite(state->timeJumping)
+		&& isfinite(state->timeOfDay) && isfinite(state->spawnCredit);
+}
+
+static uint64_t particleOffset(void)
+{
+	uint64_t used = sizeof(CheckpointHeader) + sizeof(CheckpointState);
+	return (used + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+}
+
+bool saveCheckpoint(const Scene *s, const char *path)
+{
+	unsigned char *front = calloc(1, (size_t)particleOffset());
+	if (front == NULL) {
+		fprintf(stderr, "Out of memory writing \"%s\"\n", path);
+		return false;
+	}
+
+	// The pool is saved at its own capacity, which always covers the budget,
+	// so a resumed scene never has to grow it.
+	CheckpointHeader header = { "SNOWCKPT", CHECKPOINT_VERSION, sizeof(CheckpointState), particleOffset(),
+		particleLayoutBytes(s->snow.capacity), s->snow.capacity, s->snow.count };
+
+	CheckpointState state;
+	memset(&state, 0, sizeof(state));
+	memcpy(state.groundVertices, s->groundVertices, sizeof(state.groundVertices));
+	memcpy(state.snowman, s->snowman, sizeof(state.snowman));
+	state.cover = s->cover;
+	state.wind = s->wind;
+	state.snowmanOffset = s->snowmanOffset;
+	state.timeJumping = s->timeJumping;
+	state.timeOfDay = timeOfDay(s);
+	state.spawnCredit = s->emitter.credit;
+	state.particleBudget = s->particleBudget;
+	state.baseBudget = s->baseBudget;
+	state.budgetScale = s->budgetScale;
+	state.seed = s->seed;
+	state.frame = s->frame;
+	state.snowFall = s->snowFall;
+	state.jumping = s->jumping;
+	state.prefilled = s->emitter.prefilled;
+
+	memcpy(front, &header, sizeof(header));
+	memcpy(front + sizeof(header), &state, sizeof(state));
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "Can't create \"%s\"\n", path);
+		free(front);
+		return false;
+	}
+
+	// The store's arrays are contiguous from x, in the layout initParticles() gives.
+	bool ok = fwrite(front, 1, (size_t)header.particleOffset, file) == header.particleOffset
+		&& fwrite(s->snow.x, 1, (size_t)header.particleBytes, file) == header.particleBytes;
+	ok = fclose(file) == 0 && ok;
+	free(front);
+	if (!ok) {
+		fprintf(stderr, "Couldn't write \"%s\"\n", path);
+	}
+	return ok;
+}
+
+bool loadCheckpoint(Scene *s, const Config *c, const char *path)
+{
+	size_t size = 0;
+	unsigned char *mapping = mapFile(path, &size);
+	if (mapping == NULL) {
+		fprintf(stderr, "Can't map checkpoint \"%s\"\n", path);
+		return false;
+	}
+
+	CheckpointHeader header;
+	CheckpointState state;
+	bool valid = size >= sizeof(header) + sizeof(state);
+	if (valid) {
+		memcpy(&header, mapping, sizeof(header));
+		memcpy(&state, mapping + sizeof(header), sizeof(state));
+		valid = memcmp(header.magic, "SNOWCKPT", sizeof(header.magic)) == 0
+			&& header.version == CHECKPOINT_VERSION
+			&& header.stateBytes == sizeof(CheckpointState)
+			&& header.particleOffset == particleOffset()
+			&& header.capacity > 0
+			&& header.particleBytes == particleLayoutBytes(header.capacity)
+			&& header.particleOffset + header.particleBytes <= size
+			&& header.count >= 0 && header.count <= header.capacity
+			&& state.particleBudget > 0 && state.particleBudget <= header.capacity
+			&& state.baseBudget > 0 && state.baseBudget <= MAX_PARTICLES && state.budgetScale > 0 && state.budgetScale <= BUDGET_SCALE
+			&& validState(&state);
+	}
+	if (!valid) {
+		fprintf(stderr, "\"%s\" isn't a checkpoint this version can load\n", path);
+		unmapFile(mapping, size);
+		return false;
+	}
+
+	// initScene() keeps a pool that is already there.
+	if (s->snow.block != NULL) {
+		freeParticles(&s->snow);
+	}
+	mapParticles(&s->snow, mapping, size, (size_t)header.particleOffset, header.capacity, header.count);
+	initScene(s, c);
+	s->snow.count = header.count;
+
+	memcpy(s->groundVertices, state.groundVertices, sizeof(state.groundVertices));
+	memcpy(s->snowman, state.snowman, sizeof(state.snowman));
+	s->cover = state.cover;
+	s->wind = state.wind;
+	s->snowmanOffset = state.snowmanOffset;
+	s->timeJumping = state.timeJumping;
+	s->emitter.credit = state.spawnCredit;
+	s->particleBudget = state.particleBudget;
+	s->baseBudget = state.baseBudget;
+	s->budgetScale = state.budgetScale;
+	s->seed = state.seed;
+	s->frame = state.frame;
+	s->snowFall = state.snowFall != 0;
+	s->jumping = state.jumping != 0;
+	s->emitter.prefilled = state.prefilled != 0;
+	setTimeOfDay(s, state.timeOfDay);
+	s->previousSnowmanOffset = s->snowmanOffset;
+	return true;
+}
+
+void startScene(Scene *s, const Config *c)
+{
+	if (c->resume[0] == '\0') {
+		initScene(s, c);
+	}
+	else if (!loadCheckpoint(s, c, c->resume)) {
+		exit(1);
+	}
+}
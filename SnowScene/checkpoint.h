@@ -0,0 +1,59 @@
+/******************************************************************************
+ *
+ * Scene checkpoints
+ *
+ * The whole scene state - particles, snow cover, wind, ground, snowman, sun,
+ * sky and the random number counters - saved to a flat file that a later run maps and
+ * uses in place, so it starts at steady state instead of filling up with snow
+ * at one flake per frame.
+ *
+ * The layout is native (little-endian x86/x64) and versioned:
+ *
+ *   header       magic "SNOWCKPT", version, layout sizes, particle count
+ *   state        every scene field except the particles
+ *   (padding)    up to the next multiple of CHECKPOINT_ALIGNMENT
+ *   particles    x, y, speed, size and transparency, then the scratch arrays,
+ *                laid out exactly as initParticles() lays out a pool
+ *
+ * so loading checks the header and points the particle store straight at the
+ * mapped file. The mapping is copy-on-write: the running scene never changes
+ * the file, and only the pages it touches get copied.
+ *
+ ******************************************************************************/
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+
+#include "config.h"
+#include "scene.h"
+
+#define CHECKPOINT_VERSION 6
+
+// The particle arrays start on a multiple of this (a page), so they stay aligned.
+#define CHECKPOINT_ALIGNMENT 4096
+
+/*
+	Write s to path. Returns false (after printing why) on failure.
+*/
+bool saveCheckpoint(const Scene *s, const char *path);
+
+/*
+	Set s up as initScene() would with c, then replace its state with the
+	checkpoint at path, mapped in place. The checkpoint's particle budget and
+	seed win over c's. Returns false (after printing why) if the file can't be
+	mapped, wasn't written by this version, or holds state no run could have
+	made. The flakes aren't read here, so loading takes the same time for any
+	number of them; a bad one is held to a sane size, position and
+	transparency where it is used (see flakeSize()).
+*/
+bool loadCheckpoint(Scene *s, const Config *c, const char *path);
+
+/*
+	initScene(), or loadCheckpoint() from the checkpoint c names (--resume).
+	Exits if the checkpoint can't be loaded.
+*/
+void startScene(Scene *s, const Config *c);
+
+#endif
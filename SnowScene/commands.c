@@ -0,0 +1,85 @@
+/******************************************************************************
+ *
+ * Scene commands
+ *
+ ******************************************************************************/
+
+#include "commands.h"
+#include "atomics.h"
+#include "record.h"
+
+#include <stdio.h>
+
+bool pushCommand(CommandQueue *q, Command command)
+{
+	int64_t tail = q->tail;
+	if (tail - atomicLoad64(&q->head) == COMMAND_QUEUE_SIZE) {
+		return false;
+	}
+	q->slots[tail & (COMMAND_QUEUE_SIZE - 1)] = command;
+	atomicStore64(&q->tail, tail + 1);
+	return true;
+}
+
+bool popCommand(CommandQueue *q, Command *command)
+{
+	int64_t head = q->head;
+	if (head == atomicLoad64(&q->tail)) {
+		return false;
+	}
+	*command = q->slots[head & (COMMAND_QUEUE_SIZE - 1)];
+	atomicStore64(&q->head, head + 1);
+	return true;
+}
+
+void applyCommand(Scene *s, Command command)
+{
+	if (isReplaying()) {
+		return;
+	}
+	recordCommand(s, command);
+	executeCommand(s, command);
+}
+
+// The particle budget is the base budget cut down by the governor's scale.
+static void updateBudget(Scene *s)
+{
+	int budget = (int)(s->baseBudget * ((double)s->budgetScale / BUDGET_SCALE) + 0.5);
+	budget = budget > 1 ? budget : 1;
+	if (budget > MAX_PARTICLES) {
+		fprintf(stderr, "Can't keep more than %d particles, asked for %d\n", MAX_PARTICLES, budget);
+	}
+	else if (!setParticleBudget(s, budget)) {
+		fprintf(stderr, "Out of memory growing the particle pool to %d\n", budget);
+	}
+}
+
+void executeCommand(Scene *s, Command command)
+{
+	switch (command.type) {
+		case COMMAND_TOGGLE_SNOW:
+			s->snowFall = !s->snowFall;
+			break;
+		case COMMAND_JUMP:
+			if (!s->jumping) {
+				s->jumping = true;
+			}
+			break;
+		case COMMAND_SET_BUDGET:
+			s->baseBudget = command.value;
+			updateBudget(s);
+			break;
+		case COMMAND_SCALE_BUDGET:
+			s->budgetScale = command.value;
+			updateBudget(s);
+			break;
+		case COMMAND_SET_SNOW:
+			s->snowFall = command.value != 0;
+			break;
+		case COMMAND_SET_TIME:
+			setTimeOfDay(s, command.time);
+			break;
+		case COMMAND_SNAPSHOT:
+			break;
+	}
+}
@@ -0,0 +1,64 @@
+/******************************************************************************
+ *
+ * Scene commands
+ *
+ * Changes to the scene asked for from outside the simulation (keys, the
+ * density governor, the control channel). When the simulation runs on its own thread they can't
+ * touch the scene directly, so they are queued as commands and applied by
+ * that thread between ticks.
+ *
+ * A CommandQueue is a fixed ring with a single producer and a single
+ * consumer: each side only ever stores its own index, so neither locks.
+ *
+ ******************************************************************************/
+
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "scene.h"
+
+typedef enum {
+	COMMAND_TOGGLE_SNOW,
+	COMMAND_JUMP,
+	COMMAND_SET_BUDGET,   // value: the new base particle budget
+	COMMAND_SET_SNOW,     // value: 1 to start the snow, 0 to stop it
+	COMMAND_SET_TIME,     // time: see setTimeOfDay()
+	COMMAND_SCALE_BUDGET, // value: the density governor's new budgetScale
+	COMMAND_SNAPSHOT,     // report the scene's state; answered by the control channel
+} CommandType;
+
+typedef struct {
+	CommandType type;
+	int value;
+	float time;
+} Command;
+
+// Commands a queue holds before pushCommand() reports it full (a power of two).
+#define COMMAND_QUEUE_SIZE 64
+
+typedef struct {
+	Command slots[COMMAND_QUEUE_SIZE];
+	volatile int64_t head; // next slot to read; only the consumer stores it
+	char padding[64 - sizeof(int64_t)];
+	volatile int64_t tail; // next slot to write; only the producer stores it
+} CommandQueue;
+
+// Producer side. Returns false, dropping the command, if the queue is full.
+bool pushCommand(CommandQueue *q, Command command);
+
+// Consumer side. Returns false if there is nothing to read.
+bool popCommand(CommandQueue *q, Command *command);
+
+/*
+	Carry out one command on s, recording it if a recording is running. During
+	a replay it is ignored instead. Call from the thread that steps s.
+*/
+void applyCommand(Scene *s, Command command);
+
+// Carry out one command on s, whether or not anything is recorded or replayed.
+void executeCommand(Scene *s, Command command);
+
+#endif
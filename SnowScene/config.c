@@ -0,0 +1,287 @@
+/******************************************************************************
+ *
+ * Run-time configuration
+ *
+ ******************************************************************************/
+
+#include "config.h"
+#include "emitter.h"
+#include "export.h"
+#include "headless.h"
+#include "pacer.h"
+#include "scene.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Config config = {
+	DEFAULT_PARTICLES,
+	0,
+	false,
+	0,
+	0,
+	1,
+	false,
+	DEFAULT_WIDTH,
+	DEFAULT_HEIGHT,
+	0,
+	EXPORT_DEFAULT_OUTPUT,
+	DEFAULT_FPS,
+	DEFAULT_TICK_RATE,
+	"",
+	false,
+	false,
+	"",
+	"",
+	"",
+	"",
+	"",
+	"",
+	DEFAULT_SPAWN_RATE,
+	1,
+	false,
+	false,
+	false,
+};
+
+typedef enum {
+	OPTION_INT,
+	OPTION_FLAG,
+	OPTION_TEXT, // a char[CONFIG_TEXT_LENGTH]
+} OptionType;
+
+typedef struct {
+	const char *name;
+	OptionType type;
+	size_t offset;
+	int minimum;
+	int implicitValue; // used when an integer option is given without a value (0: value required)
+} Option;
+
+static const Option options[] = {
+	{ "particles", OPTION_INT, offsetof(Config, particles), 1, 0 },
+	{ "capacity", OPTION_INT, offsetof(Config, capacity), 0, 0 },
+	{ "huge-pages", OPTION_FLAG, offsetof(Config, hugePages), 0, 0 },
+	{ "headless", OPTION_INT, offsetof(Config, headlessFrames), 1, HEADLESS_DEFAULT_FRAMES },
+	{ "seed", OPTION_INT, offsetof(Config, seed), 0, 0 },
+	{ "threads", OPTION_INT, offsetof(Config, threads), 0, 0 },
+	{ "software", OPTION_FLAG, offsetof(Config, software), 0, 0 },
+	{ "width", OPTION_INT, offsetof(Config, width), 1, 0 },
+	{ "height", OPTION_INT, offsetof(Config, height), 1, 0 },
+	{ "export", OPTION_INT, offsetof(Config, exportFrames), 1, 0 },
+	{ "output", OPTION_TEXT, offsetof(Config, output), 0, 0 },
+	{ "fps", OPTION_INT, offsetof(Config, fps), 1, 0 },
+	{ "tick-rate", OPTION_INT, offsetof(Config, tickRate), 1, 0 },
+	{ "timings", OPTION_TEXT, offsetof(Config, timings), 0, 0 },
+	{ "fixed-density", OPTION_FLAG, offsetof(Config, fixedDensity), 0, 0 },
+	{ "pipeline", OPTION_FLAG, offsetof(Config, pipeline), 0, 0 },
+	{ "control", OPTION_TEXT, offsetof(Config, control), 0, 0 },
+	{ "trace", OPTION_TEXT, offsetof(Config, trace), 0, 0 },
+	{ "record", OPTION_TEXT, offsetof(Config, record), 0, 0 },
+	{ "replay", OPTION_TEXT, offsetof(Config, replay), 0, 0 },
+	{ "checkpoint", OPTION_TEXT, offsetof(Config, checkpoint), 0, 0 },
+	{ "resume", OPTION_TEXT, offsetof(Config, resume), 0, 0 },
+	{ "spawn-rate", OPTION_INT, offsetof(Config, spawnRate), 0, 0 },
+	{ "burst", OPTION_INT, offsetof(Config, burst), 1, 0 },
+	{ "prefill", OPTION_FLAG, offsetof(Config, prefill), 0, 0 },
+	{ "stable-retire", OPTION_FLAG, offsetof(Config, stableRetire), 0, 0 },
+	{ "self-test", OPTION_FLAG, offsetof(Config, selfTest), 0, 0 },
+};
+
+#define OPTION_COUNT (int)(sizeof(options) / sizeof(options[0]))
+
+static const Option *findOption(const char *name)
+{
+	for (int i = 0; i < OPTION_COUNT; i++) {
+		if (strcmp(options[i].name, name) == 0) {
+			return &options[i];
+		}
+	}
+	return NULL;
+}
+
+static bool parseInt(const char *text, int *value)
+{
+	char *end;
+	errno = 0;
+	long parsed = strtol(text, &end, 10);
+	if (end == text || *end != '\0' || errno != 0 || parsed < INT_MIN || parsed > INT_MAX) {
+		return false;
+	}
+	*value = (int)parsed;
+	return true;
+}
+
+static bool parseFlag(const char *text, bool *value)
+{
+	if (strcmp(text, "1") == 0 || strcmp(text, "true") == 0 || strcmp(text, "yes") == 0 || strcmp(text, "on") == 0) {
+		*value = true;
+		return true;
+	}
+	if (strcmp(text, "0") == 0 || strcmp(text, "false") == 0 || strcmp(text, "no") == 0 || strcmp(text, "off") == 0) {
+		*value = false;
+		return true;
+	}
+	return false;
+}
+
+/*
+	Store one setting. value may be NULL for flags and for integer options with
+	an implicit value.
+*/
+static bool applyOption(Config *c, const Option *option, const char *value)
+{
+	char *field = (char *)c + option->offset;
+
+	switch (option->type) {
+		case OPTION_INT: {
+			int parsed = option->implicitValue;
+			if (value != NULL && !parseInt(value, &parsed)) {
+				fprintf(stderr, "%s: expected a whole number, got \"%s\"\n", option->name, value);
+				return false;
+			}
+			if (value == NULL && parsed == 0) {
+				fprintf(stderr, "%s: missing value\n", option->name);
+				return false;
+			}
+			if (parsed < option->minimum) {
+				fprintf(stderr, "%s: must be at least %d\n", option->name, option->minimum);
+				return false;
+			}
+			*(int *)field = parsed;
+			return true;
+		}
+		case OPTION_FLAG: {
+			bool parsed = true;
+			if (value != NULL && !parseFlag(value, &parsed)) {
+				fprintf(stderr, "%s: expected on or off, got \"%s\"\n", option->name, value);
+				return false;
+			}
+			*(bool *)field = parsed;
+			return true;
+		}
+		case OPTION_TEXT: {
+			if (value == NULL) {
+				fprintf(stderr, "%s: missing value\n", option->name);
+				return false;
+			}
+			if (strlen(value) >= CONFIG_TEXT_LENGTH) {
+				fprintf(stderr, "%s: longer than %d characters\n", option->name, CONFIG_TEXT_LENGTH - 1);
+				return false;
+			}
+			strcpy(field, value);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool parseArguments(Config *c, int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (strncmp(arg, "--", 2) != 0) {
+			fprintf(stderr, "Unexpected argument \"%s\"\n", arg);
+			return false;
+		}
+
+		// Anything that doesn't look like another option is this option's value.
+		const char *value = NULL;
+		if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+			value = argv[i + 1];
+		}
+
+		if (strcmp(arg + 2, "config") == 0) {
+			if (value == NULL) {
+				fprintf(stderr, "config: missing file name\n");
+				return false;
+			}
+			if (!loadConfigFile(c, value)) {
+				return false;
+			}
+			i++;
+			continue;
+		}
+
+		const Option *option = findOption(arg + 2);
+		if (option == NULL) {
+			fprintf(stderr, "Unknown option \"%s\"\n", arg);
+			return false;
+		}
+
+		// Flags only take an explicit value in config files.
+		if (option->type == OPTION_FLAG) {
+			value = NULL;
+		}
+		if (!applyOption(c, option, value)) {
+			return false;
+		}
+		if (value != NULL) {
+			i++;
+		}
+	}
+	return true;
+}
+
+static char *trim(char *text)
+{
+	while (isspace((unsigned char)*text)) {
+		text++;
+	}
+	char *end = text + strlen(text);
+	while (end > text && isspace((unsigned char)end[-1])) {
+		*--end = '\0';
+	}
+	return text;
+}
+
+bool loadConfigFile(Config *c, const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Can't open config file \"%s\"\n", path);
+		return false;
+	}
+
+	char line[512];
+	int lineNumber = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), file) != NULL) {
+		lineNumber++;
+
+		char *comment = strchr(line, '#');
+		if (comment != NULL) {
+			*comment = '\0';
+		}
+		char *key = trim(line);
+		if (*key == '\0') {
+			continue;
+		}
+
+		char *equals = strchr(key, '=');
+		if (equals == NULL) {
+			fprintf(stderr, "%s:%d: expected \"key = value\"\n", path, lineNumber);
+			ok = false;
+			break;
+		}
+		*equals = '\0';
+		key = trim(key);
+		char *value = trim(equals + 1);
+
+		const Option *option = findOption(key);
+		if (option == NULL) {
+			fprintf(stderr, "%s:%d: unknown setting \"%s\"\n", path, lineNumber, key);
+			ok = false;
+			break;
+		}
+		ok = applyOption(c, option, *value != '\0' ? value : NULL);
+	}
+
+	fclose(file);
+	return ok;
+}
@@ -0,0 +1,68 @@
+/******************************************************************************
+ *
+ * Run-time configuration
+ *
+ * Settings come from the command line and, optionally, a config file of
+ * "key = value" lines. The keys are the long option names without the leading
+ * dashes, e.g. "particles = 5000000". Options are applied left to right, so
+ * anything after "--config file" overrides the file.
+ *
+ ******************************************************************************/
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+
+// Number of flakes in the default (kiosk) scene.
+#define DEFAULT_PARTICLES 1500
+
+// Window (or software framebuffer) size in pixels.
+#define DEFAULT_WIDTH 1000
+#define DEFAULT_HEIGHT 1000
+
+// Longest text setting (e.g. a file name), including the terminator.
+#define CONFIG_TEXT_LENGTH 260
+
+typedef struct {
+	int particles;      // particle budget: how many flakes the scene keeps alive
+	int capacity;       // particles reserved up front (0 means the budget)
+	bool hugePages;     // back the particle pool with large pages if the OS allows
+	int headlessFrames; // run this many frames without a window (0 opens a window)
+	int seed;           // random seed (0 picks one from the clock)
+	int threads;        // threads updating particles (0: one per logical processor)
+	bool software;      // render on the CPU instead of through OpenGL
+	int width;          // initial window size in pixels
+	int height;
+	int exportFrames;   // render this many frames to output without a window (0: don't)
+	char output[CONFIG_TEXT_LENGTH]; // where exported frames go; see export.h
+	int fps;            // frames per second the window is paced to
+	int tickRate;       // simulation steps per second, whatever the frame rate
+	char timings[CONFIG_TEXT_LENGTH]; // write frame timings here on exit ("" for none)
+	bool fixedDensity;  // keep the full particle budget even when frames run over
+	bool pipeline;      // step the scene on its own thread while the window draws
+	char control[CONFIG_TEXT_LENGTH]; // read commands from here: "-" for stdin, or a socket path ("" for none)
+	char trace[CONFIG_TEXT_LENGTH];   // write a Chrome trace of the run here on exit ("" for none)
+	char record[CONFIG_TEXT_LENGTH];  // record the seed and every command here ("" for none)
+	char replay[CONFIG_TEXT_LENGTH];  // replay a recording made with record ("" for none)
+	char checkpoint[CONFIG_TEXT_LENGTH]; // save the scene here on exit ("" for none)
+	char resume[CONFIG_TEXT_LENGTH];  // start from this checkpoint instead of an empty scene ("" for none)
+	int spawnRate;      // flakes added per second while snow falls
+	int burst;          // flakes added together
+	bool prefill;       // fill the sky to the budget as soon as snow falls
+	bool stableRetire;  // keep the flakes' draw order when the snow stops
+	bool selfTest;      // run the regression checks and exit
+} Config;
+
+extern Config config;
+
+/*
+	Apply the command line to c, on top of whatever it already holds. Prints a
+	message and returns false on an unknown option or a bad value.
+*/
+bool parseArguments(Config *c, int argc, char **argv);
+
+// Apply a config file to c. Prints a message and returns false on failure.
+bool loadConfigFile(Config *c, const char *path);
+
+#endif
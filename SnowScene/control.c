@@ -0,0 +1,283 @@
+/******************************************************************************
+ *
+ * Control channel
+ *
+ ******************************************************************************/
+
+#include "control.h"
+#include "atomics.h"
+#include "commands.h"
+#include "platform.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Longest command line, including the terminator; longer lines are rejected.
+#define CONTROL_LINE_LENGTH 256
+
+// Passed to readCommands() instead of a socket to read stdin.
+#define CONTROL_STDIN -1
+
+static CommandQueue queue;
+static Thread reader;
+static bool started;
+static int listener = -1;
+static const char *socketPath; // removed again by stopControl()
+static volatile int32_t quitRequested;
+
+// Where replies go. Both threads reply, so these are guarded by replyMutex.
+static Mutex replyMutex;
+static bool replyToStdout;
+static int replySocket = -1; // the connected client, if any
+
+static void reply(const char *format, ...)
+{
+	char line[512];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(line, sizeof(line) - 1, format, args);
+	va_end(args);
+	if (length < 0) {
+		return;
+	}
+	if (length > (int)sizeof(line) - 2) {
+		length = (int)sizeof(line) - 2;
+	}
+	line[length++] = '\n';
+
+	mutexLock(&replyMutex);
+	if (replyToStdout) {
+		fwrite(line, 1, (size_t)length, stdout);
+		fflush(stdout);
+	}
+	else if (replySocket != -1) {
+		localWrite(replySocket, line, length);
+	}
+	mutexUnlock(&replyMutex);
+}
+
+static void submit(Command command, const char *line)
+{
+	if (!pushCommand(&queue, command)) {
+		reply("error: command queue full, dropped \"%s\"", line);
+	}
+}
+
+static bool parseBudget(const char *text, int *budget)
+{
+	char *end;
+	errno = 0;
+	long parsed = strtol(text, &end, 10);
+	if (end == text || *end != '\0' || errno != 0 || parsed < 1 || parsed > MAX_PARTICLES) {
+		return false;
+	}
+	*budget = (int)parsed;
+	return true;
+}
+
+static void handleLine(char *line)
+{
+	char *end = line + strlen(line);
+	while (end > line && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) {
+		*--end = '\0';
+	}
+
+	char verb[16];
+	char argument[64] = "";
+	int consumed = 0;
+	int fields = sscanf(line, " %15s %63s %n", verb, argument, &consumed);
+	if (fields <= 0) {
+		return;
+	}
+	if (fields == 2 && line[consumed] != '\0') {
+		reply("error: too many arguments in \"%s\"", line);
+		return;
+	}
+
+	Command command = { COMMAND_TOGGLE_SNOW, 0, 0.0f };
+	if (strcmp(verb, "snow") == 0) {
+		if (fields == 2) {
+			if (strcmp(argument, "on") != 0 && strcmp(argument, "off") != 0) {
+				reply("error: snow takes on or off, got \"%s\"", argument);
+				return;
+			}
+			command.type = COMMAND_SET_SNOW;
+			command.value = strcmp(argument, "on") == 0;
+		}
+		submit(command, line);
+	}
+	else if (strcmp(verb, "jump") == 0) {
+		command.type = COMMAND_JUMP;
+		submit(command, line);
+	}
+	else if (strcmp(verb, "particles") == 0) {
+		command.type = COMMAND_SET_BUDGET;
+		if (fields < 2 || !parseBudget(argument, &command.value)) {
+			reply("error: particles takes a whole number from 1 to %d, got \"%s\"", MAX_PARTICLES, argument);
+			return;
+		}
+		submit(command, line);
+	}
+	else if (strcmp(verb, "time") == 0) {
+		char *number;
+		command.type = COMMAND_SET_TIME;
+		command.time = fields == 2 ? strtof(argument, &number) : NAN;
+		if (fields < 2 || *number != '\0' || !isfinite(command.time)) {
+			reply("error: time takes a fraction of the day, got \"%s\"", argument);
+			return;
+		}
+		submit(command, line);
+	}
+	else if (strcmp(verb, "snapshot") == 0) {
+		command.type = COMMAND_SNAPSHOT;
+		submit(command, line);
+	}
+	else if (strcmp(verb, "quit") == 0) {
+		atomicStore32(&quitRequested, 1);
+	}
+	else {
+		reply("error: unknown command \"%s\"", verb);
+	}
+}
+
+/*
+	Split what arrives on connection (or stdin) into lines and handle each,
+	until the other end closes.
+*/
+static void readCommands(int connection)
+{
+	char chunk[512];
+	char line[CONTROL_LINE_LENGTH];
+	int length = 0;
+	bool overlong = false;
+
+	for (;;) {
+		int got = connection == CONTROL_STDIN ? readStdin(chunk, sizeof(chunk)) : localRead(connection, chunk, sizeof(chunk));
+		if (got <= 0) {
+			return;
+		}
+		for (int i = 0; i < got; i++) {
+			if (chunk[i] == '\n') {
+				line[length] = '\0';
+				if (overlong) {
+					reply("error: line longer than %d characters", CONTROL_LINE_LENGTH - 1);
+				}
+				else {
+					handleLine(line);
+				}
+				length = 0;
+				overlong = false;
+			}
+			else if (length < CONTROL_LINE_LENGTH - 1) {
+				line[length++] = chunk[i];
+			}
+			else {
+				overlong = true;
+			}
+		}
+	}
+}
+
+static void readStdinCommands(void *unused)
+{
+	(void)unused;
+	readCommands(CONTROL_STDIN);
+}
+
+// One client at a time: the next is accepted once the current one hangs up.
+static void readSocketCommands(void *unused)
+{
+	(void)unused;
+	for (;;) {
+		int connection = localAccept(listener);
+		if (connection == -1) {
+			return;
+		}
+
+		mutexLock(&replyMutex);
+		replySocket = connection;
+		mutexUnlock(&replyMutex);
+
+		readCommands(connection);
+
+		mutexLock(&replyMutex);
+		replySocket = -1;
+		mutexUnlock(&replyMutex);
+		localClose(connection);
+	}
+}
+
+bool startControl(const char *channel)
+{
+	mutexInit(&replyMutex);
+
+	void (*function)(void *) = readStdinCommands;
+	if (strcmp(channel, "-") == 0) {
+		replyToStdout = true;
+	}
+	else {
+		listener = localListen(channel);
+		if (listener == -1) {
+#ifdef _WIN32
+			fprintf(stderr, "Control sockets need a Unix system; use \"--control -\" for stdin\n");
+#else
+			fprintf(stderr, "Couldn't listen for control commands on \"%s\": %s\n", channel, strerror(errno));
+#endif
+			return false;
+		}
+		socketPath = channel;
+		function = readSocketCommands;
+	}
+
+	if (!threadStart(&reader, function, NULL)) {
+		fprintf(stderr, "Couldn't start the control thread\n");
+		return false;
+	}
+	started = true;
+	return true;
+}
+
+void stopControl(void)
+{
+	if (socketPath != NULL) {
+		localRemove(socketPath);
+		socketPath = NULL;
+	}
+}
+
+static void replySnapshot(const Scene *s)
+{
+	float depth = 0.0f;
+	for (int column = 0; column < SNOW_COLUMNS; column++) {
+		depth += s->cover.depth[column];
+	}
+	reply("{ \"tick\": %u, \"particles\": %d, \"budget\": %d, \"snow\": %s, \"jumping\": %s, \"time\": %.4f, \"snowDepth\": %.5f }",
+		s->frame, s->snow.count, s->particleBudget, s->snowFall ? "true" : "false", s->jumping ? "true" : "false",
+		timeOfDay(s), depth / SNOW_COLUMNS);
+}
+
+void applyControlCommands(Scene *s)
+{
+	if (!started) {
+		return;
+	}
+
+	Command command;
+	while (popCommand(&queue, &command)) {
+		if (command.type == COMMAND_SNAPSHOT) {
+			replySnapshot(s);
+		}
+		else {
+			applyCommand(s, command);
+		}
+	}
+}
+
+bool controlQuitRequested(void)
+{
+	return atomicLoad32(&quitRequested) != 0;
+}
@@ -0,0 +1,49 @@
+/******************************************************************************
+ *
+ * Control channel
+ *
+ * Lets another program drive a running scene, windowed or headless, with one
+ * text command per line on stdin or on a local (Unix domain) socket:
+ *
+ *   snow [on|off]   toggle the snow, or switch it on or off
+ *   jump            make the snowman jump
+ *   particles N     set the particle budget, 1 to MAX_PARTICLES (the governor may still thin it)
+ *   time T          jump to time T of the day/night cycle (0 sunrise, 0.5 moonrise)
+ *   snapshot        reply with one line of JSON describing the scene
+ *   quit            end the run
+ *
+ * A reader thread parses the lines and pushes commands into a lock-free
+ * single-producer queue, which the thread stepping the scene drains once per
+ * frame (or per batch of ticks with --pipeline), so the frame loop never
+ * waits on the channel. Errors and snapshots are answered on the channel the
+ * command came from: stdout for stdin, the connection for a socket.
+ *
+ ******************************************************************************/
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdbool.h>
+
+#include "scene.h"
+
+/*
+	Start reading commands from channel: "-" for stdin, or the path of a socket
+	to create and listen on (not on Windows). Returns false (after printing
+	why) if the channel couldn't be opened.
+*/
+bool startControl(const char *channel);
+
+// Remove the socket startControl() created, if any, so the path is free again.
+void stopControl(void);
+
+/*
+	Apply every command that has arrived to s. Call from the thread that steps
+	s; does nothing if the channel isn't open.
+*/
+void applyControlCommands(Scene *s);
+
+// Whether a "quit" command has arrived. Safe from any thread.
+bool controlQuitRequested(void);
+
+#endif
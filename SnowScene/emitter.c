@@ -0,0 +1,62 @@
+/******************************************************************************
+ *
+ * Snow emitter
+ *
+ ******************************************************************************/
+
+#include "emitter.h"
+#include "rng.h"
+#include "scene.h"
+#include "snowcover.h"
+
+#include <math.h>
+
+void initEmitter(Emitter *e, const Config *c)
+{
+	e->rate = (float)c->spawnRate / REFERENCE_RATE;
+	e->burst = c->burst;
+	e->credit = 0.0f;
+	e->prefill = c->prefill;
+	e->prefilled = false;
+}
+
+// Spread the flakes [begin, end), just spawned at the top, between the surface and the top.
+static void spreadParticles(ParticleStore *snow, int begin, int end, const float *surface, uint32_t key)
+{
+	for (int i = begin; i < end; i++) {
+		float floor = surface[snowColumn(snow->x[i])];
+		float height = (rngAt(key, (uint32_t)i) >> 8) * (1.0f / 16777216.0f);
+		snow->y[i] = floor + (1.0f - floor) * height;
+	}
+}
+
+void emitSnow(Emitter *e, ParticleStore *snow, int budget, float scale, const float *surface,
+	uint32_t key, uint32_t prefillKey)
+{
+	int room = budget - snow->count;
+
+	if (e->prefill && !e->prefilled) {
+		e->prefilled = true;
+		if (room > 0) {
+			spawnParticles(snow, snow->count, budget, key);
+			spreadParticles(snow, snow->count, budget, surface, prefillKey);
+			snow->count = budget;
+		}
+		e->credit = 0.0f;
+		return;
+	}
+
+	e->credit += e->rate * scale;
+
+	// Whole bursts only, worked out in float so a huge rate can't overflow.
+	float owed = floorf(e->credit / e->burst) * e->burst;
+	int count = owed < (float)room ? (int)owed : room;
+	if (count > 0) {
+		spawnParticles(snow, snow->count, snow->count + count, key);
+		snow->count += count;
+		e->credit -= (float)count;
+	}
+	if (snow->count >= budget) {
+		e->credit = 0.0f;
+	}
+}
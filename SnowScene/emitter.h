@@ -0,0 +1,47 @@
+/******************************************************************************
+ *
+ * Snow emitter
+ *
+ * Decides how many flakes to add each tick and adds them in batches with
+ * spawnParticles(), straight onto the end of the particle store. Flakes are
+ * owed at a steady rate and released in whole bursts; with the defaults (60
+ * flakes a second, bursts of one) that is one flake per 60 Hz frame, as the
+ * scene always had. Optionally the store is filled to its budget the first
+ * time snow falls, with the flakes spread over the sky, so the scene starts
+ * at steady state.
+ *
+ ******************************************************************************/
+
+#ifndef EMITTER_H
+#define EMITTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "particles.h"
+
+// Flakes added per second while snow falls.
+#define DEFAULT_SPAWN_RATE 60
+
+typedef struct {
+	float rate;     // flakes per 60 Hz frame
+	int burst;      // flakes are released this many at a time
+	float credit;   // flakes owed to the rate and not yet released
+	bool prefill;   // fill to the budget the first time snow falls
+	bool prefilled;
+} Emitter;
+
+void initEmitter(Emitter *e, const Config *c);
+
+/*
+	Add the flakes owed for one tick of scale 60 Hz frames to the end of snow,
+	without going over budget. Flakes are drawn from key; if this is the
+	first tick with prefill, the store is filled to the budget instead, with
+	each flake at a height drawn from prefillKey between the surface and the
+	top of the sky.
+*/
+void emitSnow(Emitter *e, ParticleStore *snow, int budget, float scale, const float *surface,
+	uint32_t key, uint32_t prefillKey);
+
+#endif
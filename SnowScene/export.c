@@ -0,0 +1,506 @@
+/******************************************************************************
+ *
+ * Offline frame export
+ *
+ ******************************************************************************/
+
+#include "checkpoint.h"
+#include "commands.h"
+#include "config.h"
+#include "export.h"
+#include "jobs.h"
+#include "platform.h"
+#include "scene.h"
+#include "softraster.h"
+#include "trace.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Largest stored (uncompressed) deflate block.
+#define DEFLATE_BLOCK_SIZE 65535
+
+typedef enum {
+	FORMAT_PPM,
+	FORMAT_PNG,
+	FORMAT_Y4M,
+} ExportFormat;
+
+typedef struct {
+	ExportFormat format;
+	const char *output;
+	int width;
+	int height;
+	FILE *stream;           // the Y4M stream; sequences open a file per frame
+	unsigned char *scratch; // the encoder's output buffer, one whole frame
+
+	// Frame f is rendered into pixels[f % EXPORT_QUEUE_FRAMES].
+	unsigned char *pixels[EXPORT_QUEUE_FRAMES];
+
+	// Guarded by mutex.
+	Mutex mutex;
+	Condition changed;
+	int queued;    // frames rendered and not yet written
+	bool finished; // no more frames are coming
+	bool failed;   // the encoder couldn't write a frame
+} Exporter;
+
+static bool endsWith(const char *text, const char *suffix)
+{
+	size_t length = strlen(text);
+	size_t suffixLength = strlen(suffix);
+	if (length < suffixLength) {
+		return false;
+	}
+	for (size_t i = 0; i < suffixLength; i++) {
+		if (tolower((unsigned char)text[length - suffixLength + i]) != suffix[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+	A sequence name is used as a printf format, so it must hold exactly one
+	integer conversion ("%d", "%05d", ...); "%%" is a literal percent sign.
+*/
+static bool checkPattern(const char *pattern)
+{
+	int conversions = 0;
+	for (const char *c = pattern; *c != '\0'; c++) {
+		if (*c != '%') {
+			continue;
+		}
+		c++;
+		if (*c == '%') {
+			continue;
+		}
+		while (isdigit((unsigned char)*c)) {
+			c++;
+		}
+		if (*c != 'd') {
+			return false;
+		}
+		conversions++;
+	}
+	return conversions == 1;
+}
+
+/******************************************************************************
+ * Encoders
+ ******************************************************************************/
+
+// The framebuffer's rows run bottom to top; every format here wants top to bottom.
+static const unsigned char *pixelRow(const Exporter *e, const unsigned char *pixels, int row)
+{
+	return pixels + (size_t)(e->height - 1 - row) * e->width * 4;
+}
+
+static bool writePpm(Exporter *e, const unsigned char *pixels, FILE *file)
+{
+	unsigned char *out = e->scratch;
+	for (int row = 0; row < e->height; row++) {
+		const unsigned char *in = pixelRow(e, pixels, row);
+		for (int i = 0; i < e->width; i++) {
+			*out++ = in[4 * i];
+			*out++ = in[4 * i + 1];
+			*out++ = in[4 * i + 2];
+		}
+	}
+
+	size_t size = (size_t)e->width * e->height * 3;
+	return fprintf(file, "P6\n%d %d\n255\n", e->width, e->height) > 0
+		&& fwrite(e->scratch, 1, size, file) == size;
+}
+
+static uint32_t crcTable[256];
+
+static void buildCrcTable(void)
+{
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for (int k = 0; k < 8; k++) {
+			c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		}
+		crcTable[n] = c;
+	}
+}
+
+// Running CRC-32 (start from 0xFFFFFFFF, invert at the end).
+static uint32_t crcUpdate(uint32_t crc, const unsigned char *data, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+static uint32_t adler32(const unsigned char *data, size_t size)
+{
+	uint32_t a = 1;
+	uint32_t b = 0;
+	while (size > 0) {
+		// 5552 bytes is the most that can be summed before b could overflow.
+		size_t run = size < 5552 ? size : 5552;
+		for (size_t i = 0; i < run; i++) {
+			a += data[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+		data += run;
+		size -= run;
+	}
+	return b << 16 | a;
+}
+
+static void putBigEndian(unsigned char *out, uint32_t value)
+{
+	out[0] = (unsigned char)(value >> 24);
+	out[1] = (unsigned char)(value >> 16);
+	out[2] = (unsigned char)(value >> 8);
+	out[3] = (unsigned char)value;
+}
+
+// Write bytes into the chunk being built, keeping its CRC.
+static bool chunkWrite(FILE *file, uint32_t *crc, const void *data, size_t size)
+{
+	*crc = crcUpdate(*crc, data, size);
+	return fwrite(data, 1, size, file) == size;
+}
+
+static bool chunkEnd(FILE *file, uint32_t crc)
+{
+	unsigned char out[4];
+	putBigEndian(out, ~crc);
+	return fwrite(out, 1, 4, file) == 4;
+}
+
+/*
+	An RGB PNG whose zlib stream uses stored deflate blocks: no compression, but
+	cheap to write and readable by anything. Alpha is always opaque, so it is
+	dropped.
+*/
+static bool writePng(Exporter *e, const unsigned char *pixels, FILE *file)
+{
+	// Scanlines, each behind filter type 0 (none).
+	unsigned char *raw = e->scratch;
+	size_t rowBytes = (size_t)e->width * 3 + 1;
+	for (int row = 0; row < e->height; row++) {
+		const unsigned char *in = pixelRow(e, pixels, row);
+		unsigned char *out = raw + row * rowBytes;
+		*out++ = 0;
+		for (int i = 0; i < e->width; i++) {
+			*out++ = in[4 * i];
+			*out++ = in[4 * i + 1];
+			*out++ = in[4 * i + 2];
+		}
+	}
+	size_t rawSize = rowBytes * e->height;
+	size_t blocks = (rawSize + DEFLATE_BLOCK_SIZE - 1) / DEFLATE_BLOCK_SIZE;
+
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	unsigned char header[8 + 13];
+	putBigEndian(header, 13);
+	memcpy(header + 4, "IHDR", 4);
+	putBigEndian(header + 8, (uint32_t)e->width);
+	putBigEndian(header + 12, (uint32_t)e->height);
+	header[16] = 8; // bits per channel
+	header[17] = 2; // RGB
+	header[18] = 0; // deflate
+	header[19] = 0; // standard filters
+	header[20] = 0; // not interlaced
+
+	bool ok = fwrite(signature, 1, 8, file) == 8 && fwrite(header, 1, 4, file) == 4;
+	uint32_t crc = 0xFFFFFFFFu;
+	ok = ok && chunkWrite(file, &crc, header + 4, sizeof(header) - 4) && chunkEnd(file, crc);
+
+	// zlib header, the stored blocks with their 5-byte headers, then the Adler-32.
+	unsigned char length[4];
+	putBigEndian(length, (uint32_t)(2 + rawSize + 5 * blocks + 4));
+	static const unsigned char zlibHeader[2] = { 0x78, 0x01 };
+	crc = 0xFFFFFFFFu;
+	ok = ok && fwrite(length, 1, 4, file) == 4 && chunkWrite(file, &crc, "IDAT", 4)
+		&& chunkWrite(file, &crc, zlibHeader, 2);
+
+	for (size_t offset = 0; ok && offset < rawSize; offset += DEFLATE_BLOCK_SIZE) {
+		size_t size = rawSize - offset < DEFLATE_BLOCK_SIZE ? rawSize - offset : DEFLATE_BLOCK_SIZE;
+		unsigned char block[5] = {
+			offset + size == rawSize, // last block flag; type 00 is stored
+			(unsigned char)size, (unsigned char)(size >> 8),
+			(unsigned char)~size, (unsigned char)(~size >> 8),
+		};
+		ok = chunkWrite(file, &crc, block, 5) && chunkWrite(file, &crc, raw + offset, size);
+	}
+
+	unsigned char checksum[4];
+	putBigEndian(checksum, adler32(raw, rawSize));
+	ok = ok && chunkWrite(file, &crc, checksum, 4) && chunkEnd(file, crc);
+
+	static const unsigned char end[12] = { 0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82 };
+	return ok && fwrite(end, 1, 12, file) == 12;
+}
+
+/*
+	One 4:2:0 frame of the stream: BT.601 studio-range luma at full size, then
+	each chroma plane averaged over 2x2 blocks.
+*/
+static bool writeY4mFrame(Exporter *e, const unsigned char *pixels)
+{
+	int chromaWidth = (e->width + 1) / 2;
+	int chromaHeight = (e->height + 1) / 2;
+	unsigned char *luma = e->scratch;
+	unsigned char *blue = luma + (size_t)e->width * e->height;
+	unsigned char *red = blue + (size_t)chromaWidth * chromaHeight;
+
+	for (int row = 0; row < e->height; row++) {
+		const unsigned char *in = pixelRow(e, pixels, row);
+		unsigned char *out = luma + (size_t)row * e->width;
+		for (int i = 0; i < e->width; i++) {
+			int r = in[4 * i], g = in[4 * i + 1], b = in[4 * i + 2];
+			out[i] = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+		}
+	}
+
+	for (int row = 0; row < chromaHeight; row++) {
+		// Odd sizes repeat the last row or column.
+		const unsigned char *top = pixelRow(e, pixels, 2 * row);
+		const unsigned char *bottom = pixelRow(e, pixels, 2 * row + 1 < e->height ? 2 * row + 1 : 2 * row);
+		for (int i = 0; i < chromaWidth; i++) {
+			int left = 8 * i;
+			int right = 2 * i + 1 < e->width ? left + 4 : left;
+			int r = top[left] + top[right] + bottom[left] + bottom[right];
+			int g = top[left + 1] + top[right + 1] + bottom[left + 1] + bottom[right + 1];
+			int b = top[left + 2] + top[right + 2] + bottom[left + 2] + bottom[right + 2];
+			// Sums of four pixels: the extra 2 bits come off with the rounding shift.
+			blue[(size_t)row * chromaWidth + i] = (unsigned char)(((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+			red[(size_t)row * chromaWidth + i] = (unsigned char)(((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+		}
+	}
+
+	size_t size = (size_t)e->width * e->height + 2 * (size_t)chromaWidth * chromaHeight;
+	return fputs("FRAME\n", e->stream) >= 0 && fwrite(e->scratch, 1, size, e->stream) == size;
+}
+
+static bool writeFrame(Exporter *e, const unsigned char *pixels, int frame)
+{
+	if (e->format == FORMAT_Y4M) {
+		return writeY4mFrame(e, pixels);
+	}
+
+	char path[CONFIG_TEXT_LENGTH + 32];
+	snprintf(path, sizeof(path), e->output, frame);
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		fprintf(stderr, "Can't create \"%s\"\n", path);
+		return false;
+	}
+	bool ok = e->format == FORMAT_PNG ? writePng(e, pixels, file) : writePpm(e, pixels, file);
+	ok = fclose(file) == 0 && ok;
+	if (!ok) {
+		fprintf(stderr, "Couldn't write \"%s\"\n", path);
+	}
+	return ok;
+}
+
+/******************************************************************************
+ * Encoder thread
+ ******************************************************************************/
+
+static void encoderThread(void *argument)
+{
+	Exporter *e = argument;
+	traceThreadName("encoder", 0);
+
+	for (int frame = 0;; frame++) {
+		mutexLock(&e->mutex);
+		while (e->queued == 0 && !e->finished) {
+			conditionWait(&e->changed, &e->mutex);
+		}
+		bool done = e->queued == 0;
+		mutexUnlock(&e->mutex);
+		if (done) {
+			return;
+		}
+
+		bool ok;
+		TRACE_ZONE("writeFrame", ok = writeFrame(e, e->pixels[frame % EXPORT_QUEUE_FRAMES], frame));
+
+		mutexLock(&e->mutex);
+		e->queued--;
+		if (!ok) {
+			e->failed = true;
+		}
+		conditionWakeAll(&e->changed);
+		mutexUnlock(&e->mutex);
+		if (!ok) {
+			return;
+		}
+	}
+}
+
+/*
+	Allocate the scratch buffer and the frame queue, fb drawing into the first
+	frame, and open the Y4M stream if there is one. Whatever was made before a
+	failure is left for closeExport().
+*/
+static bool openExport(Exporter *e, Framebuffer *fb)
+{
+	// The PNG scanlines are the largest encoded frame.
+	e->scratch = malloc(((size_t)e->width * 3 + 1) * e->height);
+	bool ok = e->scratch != NULL && initFramebuffer(fb, e->width, e->height);
+	e->pixels[0] = ok ? fb->pixels : NULL;
+	for (int i = 1; ok && i < EXPORT_QUEUE_FRAMES; i++) {
+		e->pixels[i] = alignedAlloc((size_t)e->width * e->height * 4, 64);
+		ok = e->pixels[i] != NULL;
+	}
+	if (!ok) {
+		fprintf(stderr, "Couldn't allocate %d %dx%d frames\n", EXPORT_QUEUE_FRAMES, e->width, e->height);
+		return false;
+	}
+
+	if (e->format == FORMAT_Y4M) {
+		if (strcmp(e->output, "-") == 0) {
+			binaryStdout();
+			e->stream = stdout;
+		}
+		else {
+			e->stream = fopen(e->output, "wb");
+			if (e->stream == NULL) {
+				fprintf(stderr, "Can't create \"%s\"\n", e->output);
+				return false;
+			}
+		}
+		fprintf(e->stream, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", e->width, e->height, EXPORT_FPS);
+	}
+	buildCrcTable();
+	return true;
+}
+
+// Finish the stream and release everything openExport() made. Returns false if the stream couldn't be finished.
+static bool closeExport(Exporter *e, Framebuffer *fb)
+{
+	bool ok = true;
+	if (e->stream != NULL && e->stream != stdout) {
+		ok = fclose(e->stream) == 0;
+	}
+	else if (e->stream != NULL) {
+		ok = fflush(e->stream) == 0;
+	}
+
+	// Once handed over, the framebuffer's own pixels are among e->pixels.
+	if (e->pixels[0] != NULL) {
+		fb->pixels = NULL;
+	}
+	freeFramebuffer(fb);
+	for (int i = 0; i < EXPORT_QUEUE_FRAMES; i++) {
+		alignedFree(e->pixels[i]);
+	}
+	free(e->scratch);
+	return ok;
+}
+
+// Render the frames with the encoder thread writing them out behind. Returns false if any couldn't be written.
+static bool exportFrames(Exporter *e, Framebuffer *fb, int frames)
+{
+	mutexInit(&e->mutex);
+	conditionInit(&e->changed);
+	Thread encoder;
+	if (!threadStart(&encoder, encoderThread, e)) {
+		fprintf(stderr, "Couldn't start the encoder thread\n");
+		conditionDestroy(&e->changed);
+		mutexDestroy(&e->mutex);
+		return false;
+	}
+
+	startScene(&scene, &config);
+
+	// As a command, so a recording starts the snow too (and a replay leaves
+	// it to the recording).
+	Command startSnow = { COMMAND_SET_SNOW, 1, 0.0f };
+	applyCommand(&scene, startSnow);
+
+	uint64_t waitTime = 0;
+	uint64_t start = timeNowNs();
+	int rendered = 0;
+	for (; rendered < frames; rendered++) {
+		// Wait for the encoder to release the oldest buffer.
+		uint64_t waitStart = timeNowNs();
+		mutexLock(&e->mutex);
+		while (e->queued == EXPORT_QUEUE_FRAMES && !e->failed) {
+			conditionWait(&e->changed, &e->mutex);
+		}
+		bool failed = e->failed;
+		mutexUnlock(&e->mutex);
+		waitTime += timeNowNs() - waitStart;
+		if (failed) {
+			break;
+		}
+
+		// Frames are EXPORT_FPS apart in scene time, whatever the tick rate.
+		float alpha;
+		TRACE_ZONE("advanceScene", alpha = advanceScene(&scene, 1000000000ull / EXPORT_FPS));
+		SceneView view = viewScene(&scene, alpha);
+		fb->pixels = e->pixels[rendered % EXPORT_QUEUE_FRAMES];
+		TRACE_ZONE("renderScene", renderScene(fb, &scene, &view));
+
+		mutexLock(&e->mutex);
+		e->queued++;
+		conditionWakeAll(&e->changed);
+		mutexUnlock(&e->mutex);
+	}
+
+	mutexLock(&e->mutex);
+	e->finished = true;
+	conditionWakeAll(&e->changed);
+	mutexUnlock(&e->mutex);
+	threadJoin(encoder);
+	uint64_t elapsed = timeNowNs() - start;
+	conditionDestroy(&e->changed);
+	mutexDestroy(&e->mutex);
+
+	double seconds = elapsed / 1e9;
+	fprintf(stderr, "Export: %d frames at %dx%d in %.3f s (%.1f frames/sec), %.3f s waiting for the encoder\n",
+		rendered, e->width, e->height, seconds, seconds > 0.0 ? rendered / seconds : 0.0, waitTime / 1e9);
+	return !e->failed;
+}
+
+int runExport(int frames, const char *output)
+{
+	Exporter e;
+	memset(&e, 0, sizeof(e));
+	e.output = output;
+	e.width = config.width;
+	e.height = config.height;
+
+	if (strcmp(output, "-") == 0 || endsWith(output, ".y4m")) {
+		e.format = FORMAT_Y4M;
+	}
+	else if (endsWith(output, ".ppm")) {
+		e.format = FORMAT_PPM;
+	}
+	else if (endsWith(output, ".png")) {
+		e.format = FORMAT_PNG;
+	}
+	else {
+		fprintf(stderr, "output: \"%s\" should end in .ppm, .png or .y4m, or be - for stdout\n", output);
+		return 1;
+	}
+	if (e.format != FORMAT_Y4M && !checkPattern(output)) {
+		fprintf(stderr, "output: \"%s\" needs one frame number conversion such as %%05d\n", output);
+		return 1;
+	}
+
+	// Every failure from here on goes through closeExport().
+	Framebuffer fb;
+	memset(&fb, 0, sizeof(fb));
+	bool ok = openExport(&e, &fb) && exportFrames(&e, &fb, frames);
+	ok = closeExport(&e, &fb) && ok;
+
+	shutdownJobs();
+
+	return ok ? 0 : 1;
+}
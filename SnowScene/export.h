@@ -0,0 +1,39 @@
+/******************************************************************************
+ *
+ * Offline frame export
+ *
+ * Renders frames with the software rasteriser and writes them out, with no
+ * window. Simulation and rendering run on the calling thread (and the job
+ * pool); encoding and file I/O run on a separate encoder thread, fed through a
+ * ring of EXPORT_QUEUE_FRAMES frame buffers, so the renderer only waits if the
+ * encoder falls a whole ring behind.
+ *
+ * The format comes from the output name:
+ *   "-"      one YUV4MPEG2 (4:2:0) stream on stdout
+ *   "*.y4m"  one YUV4MPEG2 stream in that file
+ *   "*.ppm"  a numbered sequence of binary PPM files
+ *   "*.png"  a numbered sequence of (uncompressed) PNG files
+ * Sequence names hold one printf-style integer conversion for the frame number,
+ * e.g. "frames/snow%05d.png".
+ *
+ ******************************************************************************/
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#define EXPORT_DEFAULT_OUTPUT "frame%05d.ppm"
+
+// Frame buffers shared by the renderer and the encoder thread.
+#define EXPORT_QUEUE_FRAMES 3
+
+// Frames per second of scene time in the exported video.
+#define EXPORT_FPS 60
+
+/*
+	Step the global scene with snow falling and write frames frames to output,
+	at the configured width and height. Progress goes to stderr, since stdout
+	may be carrying the video. Returns a process exit code.
+*/
+int runExport(int frames, const char *output);
+
+#endif
@@ -0,0 +1,63 @@
+/******************************************************************************
+ *
+ * Circle geometry
+ *
+ ******************************************************************************/
+
+#include "geometry.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#define TWO_PI 6.28318530717958647692
+
+static Point *rings[CIRCLE_MAX_SEGMENTS + 1];
+
+const Point *unitCircle(int *wanted)
+{
+	int segments = *wanted;
+	if (segments < 3) {
+		segments = 3;
+	}
+	if (segments > CIRCLE_MAX_SEGMENTS) {
+		segments = CIRCLE_MAX_SEGMENTS;
+	}
+	*wanted = segments;
+
+	if (rings[segments] == NULL) {
+		Point *ring = malloc((size_t)(segments + 1) * sizeof(Point));
+		if (ring == NULL) {
+			return NULL;
+		}
+		for (int i = 0; i < segments; i++) {
+			double angle = TWO_PI * i / segments;
+			ring[i].x = (float)cos(angle);
+			ring[i].y = (float)sin(angle);
+		}
+		ring[segments] = ring[0];
+		rings[segments] = ring;
+	}
+	return rings[segments];
+}
+
+int circleSegments(float radiusPixels)
+{
+	if (radiusPixels <= CIRCLE_TOLERANCE_PIXELS) {
+		return CIRCLE_MIN_SEGMENTS;
+	}
+
+	// A chord spanning angle a sits r * (1 - cos(a / 2)) inside the circle at
+	// its midpoint; keep that within tolerance.
+	double halfAngle = acos(1.0 - CIRCLE_TOLERANCE_PIXELS / radiusPixels);
+	int segments = (int)ceil(TWO_PI / (2.0 * halfAngle));
+
+	// Multiples of four keep circles symmetric and the cache small.
+	segments = (segments + 3) & ~3;
+	if (segments < CIRCLE_MIN_SEGMENTS) {
+		return CIRCLE_MIN_SEGMENTS;
+	}
+	if (segments > CIRCLE_MAX_SEGMENTS) {
+		return CIRCLE_MAX_SEGMENTS;
+	}
+	return segments;
+}
@@ -0,0 +1,37 @@
+/******************************************************************************
+ *
+ * Circle geometry
+ *
+ * Circles are drawn from cached unit-circle rings, scaled and translated at
+ * draw time, so no trig runs per frame. The number of segments can be chosen
+ * from the circle's size on screen.
+ *
+ ******************************************************************************/
+
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include "scene.h"
+
+// Pass as the segment count to pick one from the circle's on-screen size.
+#define CIRCLE_AUTO_SEGMENTS 0
+
+#define CIRCLE_MIN_SEGMENTS 8
+#define CIRCLE_MAX_SEGMENTS 1024
+
+// Largest gap (in pixels) allowed between an automatic circle's edges and the true circle.
+#define CIRCLE_TOLERANCE_PIXELS 0.25f
+
+/*
+	The unit circle split into *segments edges, as *segments + 1 points
+	starting and ending at (1, 0). *segments is first clamped to
+	[3, CIRCLE_MAX_SEGMENTS], so loop over what it holds on return. Rings are
+	built on first use and kept for the life of the program. Not thread-safe:
+	call it from the rendering thread only.
+*/
+const Point *unitCircle(int *segments);
+
+// Segments needed for a circle of the given on-screen radius in pixels.
+int circleSegments(float radiusPixels);
+
+#endif
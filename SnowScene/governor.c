@@ -0,0 +1,58 @@
+/******************************************************************************
+ *
+ * Density governor
+ *
+ ******************************************************************************/
+
+#include "governor.h"
+
+#include <math.h>
+
+void initGovernor(Governor *g, uint64_t budgetNs)
+{
+	g->budget = budgetNs;
+	g->load = 0.0;
+	g->level = 0;
+	g->overFrames = 0;
+	g->underFrames = 0;
+	g->settleFrames = GOVERNOR_SETTLE_FRAMES;
+	g->changes = 0;
+}
+
+static void changeLevel(Governor *g, int level)
+{
+	g->level = level;
+	g->overFrames = 0;
+	g->underFrames = 0;
+	g->settleFrames = GOVERNOR_SETTLE_FRAMES;
+	g->changes++;
+}
+
+bool governFrame(Governor *g, uint64_t busyNs)
+{
+	// A running mean over about 8 frames rides out single slow frames.
+	g->load += ((double)busyNs / g->budget - g->load) / 8.0;
+
+	if (g->settleFrames > 0) {
+		g->settleFrames--;
+		return false;
+	}
+
+	g->overFrames = g->load > GOVERNOR_HIGH ? g->overFrames + 1 : 0;
+	g->underFrames = g->load < GOVERNOR_LOW ? g->underFrames + 1 : 0;
+
+	if (g->overFrames >= GOVERNOR_SHED_FRAMES && g->level + 1 < GOVERNOR_LEVELS) {
+		changeLevel(g, g->level + 1);
+		return true;
+	}
+	if (g->underFrames >= GOVERNOR_RESTORE_FRAMES && g->level > 0) {
+		changeLevel(g, g->level - 1);
+		return true;
+	}
+	return false;
+}
+
+double governorScale(const Governor *g)
+{
+	return pow(2.0, -0.5 * g->level);
+}
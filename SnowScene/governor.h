@@ -0,0 +1,60 @@
+/******************************************************************************
+ *
+ * Density governor
+ *
+ * Holds the frame rate when the machine gets busier by thinning the snow. It
+ * is fed how long each frame kept the CPU busy and compares that with the
+ * frame budget (the pacer's period). If frames stay over GOVERNOR_HIGH of the
+ * budget it drops a level, cutting the particle count by a factor of sqrt(2);
+ * once they stay under GOVERNOR_LOW for much longer it climbs back a level.
+ *
+ * The gap between the two thresholds is wider than one level's step, so a
+ * level it has just climbed to is not immediately over budget again: with
+ * the cost roughly proportional to the particle count, a frame at
+ * GOVERNOR_LOW costs about GOVERNOR_LOW * sqrt(2) < GOVERNOR_HIGH a level up.
+ *
+ ******************************************************************************/
+
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Level 0 is the full particle budget; each level down has 1/sqrt(2) as many.
+#define GOVERNOR_LEVELS 9
+
+// Load (busy time over the frame budget) thresholds for shedding and restoring.
+#define GOVERNOR_HIGH 0.90
+#define GOVERNOR_LOW 0.60
+
+// Frames the load must stay past a threshold before the level changes: shed
+// quickly, restore slowly.
+#define GOVERNOR_SHED_FRAMES 15
+#define GOVERNOR_RESTORE_FRAMES 180
+
+// Frames ignored after a change, while the new level's cost shows up in the load.
+#define GOVERNOR_SETTLE_FRAMES 30
+
+typedef struct {
+	uint64_t budget;    // ns per frame
+	double load;        // smoothed busy time as a fraction of budget
+	int level;
+	int overFrames;     // consecutive frames over GOVERNOR_HIGH
+	int underFrames;    // consecutive frames under GOVERNOR_LOW
+	int settleFrames;   // frames still to ignore after the last change
+	unsigned int changes;
+} Governor;
+
+void initGovernor(Governor *g, uint64_t budgetNs);
+
+/*
+	Account for one frame that kept the CPU busy for busyNs. Returns true if
+	the level changed, in which case governorScale() has a new value.
+*/
+bool governFrame(Governor *g, uint64_t busyNs);
+
+// Fraction of the configured particle budget to keep alive at the current level.
+double governorScale(const Governor *g);
+
+#endif
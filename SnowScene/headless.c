@@ -0,0 +1,122 @@
+/******************************************************************************
+ *
+ * Headless simulation runner
+ *
+ ******************************************************************************/
+
+#include "checkpoint.h"
+#include "commands.h"
+#include "config.h"
+#include "control.h"
+#include "headless.h"
+#include "jobs.h"
+#include "platform.h"
+#include "scene.h"
+#include "softraster.h"
+#include "trace.h"
+
+#include <stdio.h>
+
+static uint32_t hashBytes(uint32_t hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+uint32_t stateChecksum(const Scene *s)
+{
+	const ParticleStore *p = &s->snow;
+	const float *arrays[] = { p->x, p->y, p->speed, p->size, p->transparency };
+	uint32_t hash = 2166136261u;
+	for (int a = 0; a < 5; a++) {
+		hash = hashBytes(hash, arrays[a], (size_t)p->count * sizeof(float));
+	}
+	return hashBytes(hash, s->cover.depth, sizeof(s->cover.depth));
+}
+
+// FNV-1a over the framebuffer, to compare software renders between runs.
+static uint32_t pixelChecksum(const Framebuffer *fb)
+{
+	return hashBytes(2166136261u, fb->pixels, (size_t)fb->width * fb->height * 4);
+}
+
+int runHeadless(int frames)
+{
+	startScene(&scene, &config);
+
+	// As a command, so a recording starts the snow too (and a replay leaves
+	// it to the recording).
+	Command startSnow = { COMMAND_SET_SNOW, 1, 0.0f };
+	applyCommand(&scene, startSnow);
+
+	// With --software every frame is also drawn, as the window would draw it.
+	Framebuffer fb = { 0 };
+	if (config.software && !initFramebuffer(&fb, config.width, config.height)) {
+		fprintf(stderr, "Couldn't allocate a %dx%d framebuffer\n", config.width, config.height);
+		return 1;
+	}
+
+	// Every live particle is updated once per frame, so this is the work done.
+	unsigned long long particleUpdates = 0;
+	uint64_t renderTime = 0;
+
+	// With a control channel the scene runs in real time, so commands land
+	// where they would in the window, until "quit" or the last frame.
+	bool realTime = config.control[0] != '\0';
+	uint64_t idleTime = 0;
+
+	uint64_t start = timeNowNs();
+	int frame;
+	for (frame = 0; frame < frames && !controlQuitRequested(); frame++) {
+		if (realTime) {
+			uint64_t now = timeNowNs();
+			uint64_t due = start + (uint64_t)frame * scene.tickNs;
+			if (due > now) {
+				sleepNs(due - now);
+				idleTime += timeNowNs() - now;
+			}
+		}
+		applyControlCommands(&scene);
+		TRACE_ZONE("stepScene", stepScene(&scene));
+		particleUpdates += scene.snow.count;
+
+		if (config.software) {
+			// Each frame is one tick; draw the tick's result.
+			uint64_t renderStart = timeNowNs();
+			SceneView view = viewScene(&scene, 1.0f);
+			TRACE_ZONE("renderScene", renderScene(&fb, &scene, &view));
+			renderTime += timeNowNs() - renderStart;
+		}
+	}
+	frames = frame;
+	uint64_t elapsed = timeNowNs() - start - idleTime;
+	uint64_t stepTime = elapsed - renderTime;
+
+	double seconds = elapsed / 1e9;
+	printf("Headless: %d frames in %.3f s (%.1f frames/sec)\n",
+		frames, seconds, seconds > 0.0 ? frames / seconds : 0.0);
+	printf("Particles: %d live, %llu updates (%.2f ns/particle) on %d thread(s)\n",
+		scene.snow.count, particleUpdates,
+		particleUpdates > 0 ? (double)stepTime / particleUpdates : 0.0, jobThreads());
+	float deepest = 0.0f;
+	float total = 0.0f;
+	for (int column = 0; column < SNOW_COLUMNS; column++) {
+		deepest = scene.cover.depth[column] > deepest ? scene.cover.depth[column] : deepest;
+		total += scene.cover.depth[column];
+	}
+	printf("Snow cover: %.4f deep on average, %.4f at most\n", total / SNOW_COLUMNS, deepest);
+	printf("State checksum: %08x (seed %u)\n", stateChecksum(&scene), scene.seed);
+
+	if (config.software) {
+		printf("Software render: %dx%d, %.3f ms/frame, last frame checksum %08x\n",
+			fb.width, fb.height, frames > 0 ? renderTime / 1e6 / frames : 0.0, pixelChecksum(&fb));
+		freeFramebuffer(&fb);
+	}
+
+	shutdownJobs();
+
+	return 0;
+}
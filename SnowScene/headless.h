@@ -0,0 +1,34 @@
+/******************************************************************************
+ *
+ * Headless simulation runner
+ *
+ * Steps the scene as fast as the CPU allows, with no window or GL context, and
+ * reports simulation throughput. With a control channel (--control) it steps
+ * in real time instead, taking commands until "quit".
+ *
+ ******************************************************************************/
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdint.h>
+
+#include "scene.h"
+
+// Default number of frames simulated by --headless when no count is given.
+#define HEADLESS_DEFAULT_FRAMES 10000
+
+/*
+	Step the global scene for the given number of frames (one tick each) with
+	snow falling and print frames/sec and ns/particle to stdout, leaving out
+	any time spent waiting for real time. Returns a process exit code.
+*/
+int runHeadless(int frames);
+
+/*
+	FNV-1a over the particle arrays and the lying snow, so runs can be checked
+	for identical results (e.g. with different thread counts).
+*/
+uint32_t stateChecksum(const Scene *s);
+
+#endif
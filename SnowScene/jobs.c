@@ -0,0 +1,248 @@
+/******************************************************************************
+ *
+ * Job system
+ *
+ ******************************************************************************/
+
+#include "jobs.h"
+#include "atomics.h"
+#include "platform.h"
+#include "trace.h"
+
+#include <stdint.h>
+
+// Each thread's remaining run of chunks, packed as next (low 32 bits) and end
+// (high 32 bits) so owner and thieves can both update it with one CAS.
+typedef struct {
+	volatile int64_t range;
+	char padding[64 - sizeof(int64_t)]; // one queue per cache line
+} WorkQueue;
+
+static WorkQueue queues[MAX_JOB_THREADS];
+static Thread workers[MAX_JOB_THREADS];
+static int threadCount = 1;
+
+static Mutex wakeMutex;
+static Condition wakeCondition;
+static bool wakeReady; // wakeMutex and wakeCondition are set up (once, even if the pool restarts)
+static unsigned int generation;
+static unsigned int startGeneration; // jobs before the current pool started, which its workers skip
+static bool stopping;
+
+// Workers still running the current job.
+static volatile int32_t busyWorkers;
+
+// Callers inside parallelFor(); only the first gets the pool.
+static volatile int32_t poolCallers;
+
+// The current job. Written before generation is bumped, under wakeMutex.
+static JobFunction jobFunction;
+static void *jobContext;
+static int jobCount;
+static int jobChunkSize;
+
+static int64_t packRange(int next, int end)
+{
+	return (int64_t)((uint64_t)(uint32_t)end << 32 | (uint32_t)next);
+}
+
+static int rangeNext(int64_t range)
+{
+	return (int)(uint32_t)range;
+}
+
+static int rangeEnd(int64_t range)
+{
+	return (int)(uint32_t)((uint64_t)range >> 32);
+}
+
+// Take the next chunk from the front of our own run.
+static bool popChunk(int self, int *chunk)
+{
+	volatile int64_t *queue = &queues[self].range;
+	for (;;) {
+		int64_t range = atomicLoad64(queue);
+		int next = rangeNext(range);
+		int end = rangeEnd(range);
+		if (next >= end) {
+			return false;
+		}
+		if (atomicCas64(queue, range, packRange(next + 1, end))) {
+			*chunk = next;
+			return true;
+		}
+	}
+}
+
+/*
+	Move the back half of some other thread's run into our own (empty) queue.
+	Only the owner ever stores into its queue, and nobody CASes an empty one, so
+	the plain store can't race with a thief.
+*/
+static bool stealChunks(int self)
+{
+	for (int k = 1; k < threadCount; k++) {
+		volatile int64_t *victim = &queues[(self + k) % threadCount].range;
+		for (;;) {
+			int64_t range = atomicLoad64(victim);
+			int next = rangeNext(range);
+			int end = rangeEnd(range);
+			int left = end - next;
+			if (left <= 0) {
+				break;
+			}
+
+			int take = (left + 1) / 2;
+			if (atomicCas64(victim, range, packRange(next, end - take))) {
+				atomicStore64(&queues[self].range, packRange(end - take, end));
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void runChunk(int chunk)
+{
+	int begin = chunk * jobChunkSize;
+	int end = jobCount - begin > jobChunkSize ? begin + jobChunkSize : jobCount;
+	jobFunction(jobContext, begin, end);
+}
+
+// Run a whole job on the calling thread, without touching the pool's state.
+static void runInline(int count, int chunkSize, JobFunction function, void *context)
+{
+	for (int begin = 0; begin < count; begin += chunkSize) {
+		function(context, begin, count - begin > chunkSize ? begin + chunkSize : count);
+	}
+}
+
+static void runChunks(int self)
+{
+	TRACE_BEGIN(zone);
+	int chunk;
+	do {
+		while (popChunk(self, &chunk)) {
+			runChunk(chunk);
+		}
+	} while (stealChunks(self));
+	TRACE_END(zone, "parallelFor");
+}
+
+static void workerMain(void *argument)
+{
+	int self = (int)(intptr_t)argument;
+	unsigned int seen = startGeneration;
+	traceThreadName("worker %d", self);
+
+	mutexLock(&wakeMutex);
+	for (;;) {
+		while (generation == seen && !stopping) {
+			conditionWait(&wakeCondition, &wakeMutex);
+		}
+		if (stopping) {
+			break;
+		}
+		seen = generation;
+		mutexUnlock(&wakeMutex);
+
+		runChunks(self);
+		atomicAdd32(&busyWorkers, -1);
+
+		mutexLock(&wakeMutex);
+	}
+	mutexUnlock(&wakeMutex);
+}
+
+bool initJobs(int count)
+{
+	if (count <= 0) {
+		count = cpuCount();
+	}
+	if (count > MAX_JOB_THREADS) {
+		count = MAX_JOB_THREADS;
+	}
+
+	if (!wakeReady) {
+		mutexInit(&wakeMutex);
+		conditionInit(&wakeCondition);
+		wakeReady = true;
+	}
+	startGeneration = generation;
+	stopping = false;
+
+	threadCount = 1;
+	for (int i = 1; i < count; i++) {
+		if (!threadStart(&workers[i], workerMain, (void *)(intptr_t)i)) {
+			shutdownJobs();
+			return false;
+		}
+		threadCount++;
+	}
+	return true;
+}
+
+void shutdownJobs(void)
+{
+	mutexLock(&wakeMutex);
+	stopping = true;
+	conditionWakeAll(&wakeCondition);
+	mutexUnlock(&wakeMutex);
+
+	for (int i = 1; i < threadCount; i++) {
+		threadJoin(workers[i]);
+	}
+	threadCount = 1;
+}
+
+int jobThreads(void)
+{
+	return threadCount;
+}
+
+void parallelFor(int count, int chunkSize, JobFunction function, void *context)
+{
+	int chunks = (count + chunkSize - 1) / chunkSize;
+	if (chunks <= 0) {
+		return;
+	}
+
+	if (threadCount == 1 || chunks == 1) {
+		runInline(count, chunkSize, function, context);
+		return;
+	}
+
+	// Another thread has the pool: do the work here rather than wait for it.
+	if (atomicAdd32(&poolCallers, 1) != 0) {
+		atomicAdd32(&poolCallers, -1);
+		runInline(count, chunkSize, function, context);
+		return;
+	}
+
+	jobFunction = function;
+	jobContext = context;
+	jobCount = count;
+	jobChunkSize = chunkSize;
+
+	// Give each thread an even, contiguous share to start with.
+	for (int t = 0; t < threadCount; t++) {
+		atomicStore64(&queues[t].range, packRange(
+			(int)((int64_t)chunks * t / threadCount),
+			(int)((int64_t)chunks * (t + 1) / threadCount)));
+	}
+	atomicStore32(&busyWorkers, threadCount - 1);
+
+	mutexLock(&wakeMutex);
+	generation++;
+	conditionWakeAll(&wakeCondition);
+	mutexUnlock(&wakeMutex);
+
+	runChunks(0);
+
+	// A worker only leaves runChunks() once its last chunk is done and there is
+	// nothing left to steal, so when all of them have left, the job is finished.
+	while (atomicLoad32(&busyWorkers) != 0) {
+		threadYield();
+	}
+	atomicAdd32(&poolCallers, -1);
+}
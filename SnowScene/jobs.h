@@ -0,0 +1,44 @@
+/******************************************************************************
+ *
+ * Job system
+ *
+ * A persistent pool of worker threads for data-parallel loops. parallelFor()
+ * splits the range into fixed-size chunks and hands each thread a contiguous
+ * run of them; a thread that runs out steals the back half of another thread's
+ * remaining run. The call returns only once every chunk is finished, which is
+ * the barrier between think() and display().
+ *
+ ******************************************************************************/
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+
+#define MAX_JOB_THREADS 64
+
+// Processes the items [begin, end) of one chunk.
+typedef void (*JobFunction)(void *context, int begin, int end);
+
+/*
+	Start the pool with threadCount threads in total, counting the thread that
+	calls parallelFor() (so 1 runs everything inline). 0 means one per logical
+	processor. Returns false if the workers couldn't be started.
+*/
+bool initJobs(int threadCount);
+// Stop the workers. initJobs() may start the pool again afterwards.
+void shutdownJobs(void);
+
+// Number of threads parallelFor() spreads work over.
+int jobThreads(void);
+
+/*
+	Run function over [0, count) in chunks of chunkSize items across every
+	thread in the pool. Chunk boundaries depend only on count and chunkSize, so
+	work that only writes its own chunk gives the same result whatever the
+	number of threads. Any thread may call it; a call made while the pool is
+	busy with another thread's job runs every chunk on the calling thread.
+*/
+void parallelFor(int count, int chunkSize, JobFunction function, void *context);
+
+#endif
@@ -0,0 +1,91 @@
+/******************************************************************************
+ *
+ * Frame pacer
+ *
+ ******************************************************************************/
+
+#include "pacer.h"
+#include "platform.h"
+#include "simd.h"
+
+// Bounds on the spin at the end of each wait.
+#define MIN_SPIN_NS 100000ull   // 0.1 ms
+#define START_SPIN_NS 2000000ull // 2 ms, until oversleeping has been measured
+
+void initFramePacer(FramePacer *p, int fps)
+{
+	p->period = 1000000000ull / (uint64_t)fps;
+	p->deadline = timeNowNs() + p->period;
+	p->spinMargin = START_SPIN_NS;
+	p->oversleep = (int64_t)START_SPIN_NS / 2;
+	p->oversleepDeviation = (int64_t)START_SPIN_NS / 8;
+	p->lastError = 0;
+	p->worstError = 0;
+	p->meanError = 0;
+	p->windowWorst = 0;
+	p->windowTotal = 0;
+	p->windowFrames = 0;
+	p->missed = 0;
+}
+
+static inline void spinPause(void)
+{
+#if defined(SIMD_SSE2)
+	_mm_pause();
+#endif
+}
+
+void framePacerWait(FramePacer *p)
+{
+	uint64_t now = timeNowNs();
+
+	if (now + p->spinMargin < p->deadline) {
+		uint64_t request = p->deadline - p->spinMargin - now;
+		sleepNs(request);
+
+		// Spin for the usual oversleep plus a few deviations. Rare, much longer
+		// wake-ups just make that frame late rather than costing a spin every frame.
+		uint64_t woke = timeNowNs();
+		int64_t overslept = (int64_t)(woke - now) - (int64_t)request;
+		int64_t difference = overslept - p->oversleep;
+		p->oversleep += difference / 8;
+		p->oversleepDeviation += ((difference < 0 ? -difference : difference) - p->oversleepDeviation) / 8;
+
+		int64_t margin = p->oversleep + 4 * p->oversleepDeviation;
+		if (margin < (int64_t)MIN_SPIN_NS) {
+			margin = MIN_SPIN_NS;
+		}
+		if (margin > (int64_t)(p->period / 2)) {
+			margin = p->period / 2;
+		}
+		p->spinMargin = (uint64_t)margin;
+		now = woke;
+	}
+
+	while (now < p->deadline) {
+		spinPause();
+		now = timeNowNs();
+	}
+
+	int64_t error = (int64_t)(now - p->deadline);
+	p->lastError = error;
+	if (error > p->windowWorst) {
+		p->windowWorst = error;
+	}
+	p->windowTotal += error;
+	if (++p->windowFrames == PACER_WINDOW) {
+		p->worstError = p->windowWorst;
+		p->meanError = p->windowTotal / PACER_WINDOW;
+		p->windowWorst = 0;
+		p->windowTotal = 0;
+		p->windowFrames = 0;
+	}
+
+	// Next slot on the grid, skipping any we've already blown through.
+	p->deadline += p->period;
+	if (now >= p->deadline) {
+		uint64_t behind = (now - p->deadline) / p->period + 1;
+		p->deadline += behind * p->period;
+		p->missed += (unsigned int)behind;
+	}
+}
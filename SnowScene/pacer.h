@@ -0,0 +1,51 @@
+/******************************************************************************
+ *
+ * Frame pacer
+ *
+ * Holds a steady frame rate on the monotonic nanosecond clock. Deadlines are
+ * laid out on a fixed grid (start + n * period), so rounding never adds up the
+ * way a truncated millisecond FRAME_TIME did. Each wait sleeps while the
+ * deadline is comfortably far off and spins for the last stretch, whose length
+ * follows how much the OS has actually been oversleeping.
+ *
+ ******************************************************************************/
+
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+
+// Frames per second when --fps isn't given.
+#define DEFAULT_FPS 60
+
+// Frames over which the pacing error statistics are gathered before they reset.
+#define PACER_WINDOW 120
+
+typedef struct {
+	uint64_t period;     // ns per frame
+	uint64_t deadline;   // when the next frame is due
+	uint64_t spinMargin; // how long before the deadline to stop sleeping and spin
+	int64_t oversleep;   // running mean of how late sleepNs() wakes us
+	int64_t oversleepDeviation; // running mean distance from that
+
+	// Pacing error: how late (in ns) each wait returned after its deadline.
+	int64_t lastError;
+	int64_t worstError;  // over the last complete window
+	int64_t meanError;   // over the last complete window
+	int64_t windowWorst; // the window being gathered
+	int64_t windowTotal;
+	int windowFrames;
+	unsigned int missed; // deadlines skipped because a frame ran long
+} FramePacer;
+
+// Start pacing at fps frames per second, with the first deadline one period from now.
+void initFramePacer(FramePacer *p, int fps);
+
+/*
+	Wait for the next deadline and record how far off it the wait returned. If
+	the previous frame overran by more than a whole period the missed deadlines
+	are skipped rather than rushed through.
+*/
+void framePacerWait(FramePacer *p);
+
+#endif
@@ -0,0 +1,467 @@
+/******************************************************************************
+ *
+ * Particle store
+ *
+ ******************************************************************************/
+
+#include "particles.h"
+#include "jobs.h"
+#include "platform.h"
+#include "rng.h"
+#include "simd.h"
+#include "snowcover.h"
+
+#include <string.h>
+
+// Each array starts on its own cache line.
+#define PARTICLE_ALIGNMENT 64
+
+static size_t alignedArrayBytes(int capacity, size_t elementSize)
+{
+	size_t bytes = (size_t)capacity * elementSize;
+	return (bytes + PARTICLE_ALIGNMENT - 1) & ~(size_t)(PARTICLE_ALIGNMENT - 1);
+}
+
+size_t particleLayoutBytes(int capacity)
+{
+	size_t floatBytes = alignedArrayBytes(capacity, sizeof(float));
+	size_t indexBytes = alignedArrayBytes(capacity, sizeof(int));
+	size_t chunkBytes = alignedArrayBytes(capacity / PARTICLE_CHUNK_SIZE + 1, sizeof(int));
+	return 5 * floatBytes + indexBytes + chunkBytes;
+}
+
+// Point p's arrays into layout, which holds particleLayoutBytes(capacity) bytes.
+static void placeArrays(ParticleStore *p, char *layout, int capacity)
+{
+	size_t floatBytes = alignedArrayBytes(capacity, sizeof(float));
+	size_t indexBytes = alignedArrayBytes(capacity, sizeof(int));
+	p->capacity = capacity;
+	p->x = (float *)(layout);
+	p->y = (float *)(layout + floatBytes);
+	p->speed = (float *)(layout + 2 * floatBytes);
+	p->size = (float *)(layout + 3 * floatBytes);
+	p->transparency = (float *)(layout + 4 * floatBytes);
+	p->landed = (int *)(layout + 5 * floatBytes);
+	p->chunkLanded = (int *)(layout + 5 * floatBytes + indexBytes);
+}
+
+bool initParticles(ParticleStore *p, int capacity, bool hugePages)
+{
+	if (capacity > MAX_PARTICLES) {
+		return false;
+	}
+	size_t blockBytes = particleLayoutBytes(capacity);
+	char *block = pageAlloc(&blockBytes, hugePages);
+	if (block == NULL) {
+		return false;
+	}
+
+	memset(p, 0, sizeof(*p));
+	p->block = block;
+	p->blockBytes = blockBytes;
+	p->hugePages = hugePages;
+	placeArrays(p, block, capacity);
+	return true;
+}
+
+void mapParticles(ParticleStore *p, void *mapping, size_t mappingBytes, size_t offset, int capacity, int count)
+{
+	memset(p, 0, sizeof(*p));
+	p->block = mapping;
+	p->blockBytes = mappingBytes;
+	p->mapped = true;
+	placeArrays(p, (char *)mapping + offset, capacity);
+	p->count = count;
+}
+
+void freeParticles(ParticleStore *p)
+{
+	if (p->mapped) {
+		unmapFile(p->block, p->blockBytes);
+	}
+	else {
+		pageFree(p->block, p->blockBytes);
+	}
+	memset(p, 0, sizeof(*p));
+}
+
+bool reserveParticles(ParticleStore *p, int capacity)
+{
+	if (capacity <= p->capacity) {
+		return true;
+	}
+	if (capacity > MAX_PARTICLES) {
+		return false;
+	}
+	int64_t doubled = (int64_t)p->capacity * 2;
+	doubled = doubled < MAX_PARTICLES ? doubled : MAX_PARTICLES;
+	if (capacity < doubled) {
+		capacity = (int)doubled;
+	}
+
+	ParticleStore grown;
+	if (!initParticles(&grown, capacity, p->hugePages)) {
+		return false;
+	}
+
+	size_t bytes = (size_t)p->count * sizeof(float);
+	memcpy(grown.x, p->x, bytes);
+	memcpy(grown.y, p->y, bytes);
+	memcpy(grown.speed, p->speed, bytes);
+	memcpy(grown.size, p->size, bytes);
+	memcpy(grown.transparency, p->transparency, bytes);
+	grown.count = p->count;
+
+	freeParticles(p);
+	*p = grown;
+	return true;
+}
+
+/*
+	Flake i drawn from key. spawnRange() computes the same values SIMD-wide, with
+	the same operations in the same order, so both give identical flakes.
+*/
+static void spawnOne(ParticleStore *p, int i, uint32_t key)
+{
+	uint32_t first = (uint32_t)i * RNG_SPAWN_DRAWS;
+	float size = (float)(int)(rngBelow(rngAt(key, first + 1), SNOW_SIZES) + SNOW_MIN_SIZE);
+	p->x[i] = (float)(int)rngBelow(rngAt(key, first), 1000) / 1000.0f + 0.02f;
+	p->y[i] = 1.0f;
+	p->size[i] = size;
+	p->speed[i] = size / 10000.0f + 0.0002f;
+	p->transparency[i] = (float)(int)rngBelow(rngAt(key, first + 2), 10) / 10.0f + 0.1f;
+}
+
+static void spawnRange(ParticleStore *p, int begin, int end, uint32_t key)
+{
+	int i = begin;
+	uint32_t first = (uint32_t)i * RNG_SPAWN_DRAWS;
+
+#if defined(SIMD_AVX2)
+	__m256i key8 = _mm256_set1_epi32((int)key);
+	__m256i draw8 = _mm256_add_epi32(_mm256_set1_epi32((int)first), _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21));
+	__m256i one8 = _mm256_set1_epi32(1);
+	for (; i + 8 <= end; i += 8) {
+		__m256 across = _mm256_cvtepi32_ps(rngBelow8(rngAt8(key8, draw8), 1000));
+		_mm256_storeu_ps(p->x + i, _mm256_add_ps(_mm256_div_ps(across, _mm256_set1_ps(1000.0f)), _mm256_set1_ps(0.02f)));
+		_mm256_storeu_ps(p->y + i, _mm256_set1_ps(1.0f));
+
+		draw8 = _mm256_add_epi32(draw8, one8);
+		__m256 size = _mm256_cvtepi32_ps(_mm256_add_epi32(rngBelow8(rngAt8(key8, draw8), SNOW_SIZES), _mm256_set1_epi32(SNOW_MIN_SIZE)));
+		_mm256_storeu_ps(p->size + i, size);
+		_mm256_storeu_ps(p->speed + i, _mm256_add_ps(_mm256_div_ps(size, _mm256_set1_ps(10000.0f)), _mm256_set1_ps(0.0002f)));
+
+		draw8 = _mm256_add_epi32(draw8, one8);
+		__m256 alpha = _mm256_cvtepi32_ps(rngBelow8(rngAt8(key8, draw8), 10));
+		_mm256_storeu_ps(p->transparency + i, _mm256_add_ps(_mm256_div_ps(alpha, _mm256_set1_ps(10.0f)), _mm256_set1_ps(0.1f)));
+
+		draw8 = _mm256_add_epi32(draw8, _mm256_set1_epi32(8 * RNG_SPAWN_DRAWS - 2));
+	}
+	first = (uint32_t)i * RNG_SPAWN_DRAWS;
+#endif
+
+#if defined(SIMD_SSE2)
+	__m128i key4 = _mm_set1_epi32((int)key);
+	__m128i draw4 = _mm_add_epi32(_mm_set1_epi32((int)first), _mm_setr_epi32(0, 3, 6, 9));
+	__m128i one4 = _mm_set1_epi32(1);
+	for (; i + 4 <= end; i += 4) {
+		__m128 across = _mm_cvtepi32_ps(rngBelow4(rngAt4(key4, draw4), 1000));
+		_mm_storeu_ps(p->x + i, _mm_add_ps(_mm_div_ps(across, _mm_set1_ps(1000.0f)), _mm_set1_ps(0.02f)));
+		_mm_storeu_ps(p->y + i, _mm_set1_ps(1.0f));
+
+		draw4 = _mm_add_epi32(draw4, one4);
+		__m128 size = _mm_cvtepi32_ps(_mm_add_epi32(rngBelow4(rngAt4(key4, draw4), SNOW_SIZES), _mm_set1_epi32(SNOW_MIN_SIZE)));
+		_mm_storeu_ps(p->size + i, size);
+		_mm_storeu_ps(p->speed + i, _mm_add_ps(_mm_div_ps(size, _mm_set1_ps(10000.0f)), _mm_set1_ps(0.0002f)));
+
+		draw4 = _mm_add_epi32(draw4, one4);
+		__m128 alpha = _mm_cvtepi32_ps(rngBelow4(rngAt4(key4, draw4), 10));
+		_mm_storeu_ps(p->transparency + i, _mm_add_ps(_mm_div_ps(alpha, _mm_set1_ps(10.0f)), _mm_set1_ps(0.1f)));
+
+		draw4 = _mm_add_epi32(draw4, _mm_set1_epi32(4 * RNG_SPAWN_DRAWS - 2));
+	}
+#endif
+	(void)first;
+
+	for (; i < end; i++) {
+		spawnOne(p, i, key);
+	}
+}
+
+typedef struct {
+	ParticleStore *p;
+	int begin;
+	uint32_t key;
+} SpawnJob;
+
+static void spawnChunk(void *context, int begin, int end)
+{
+	SpawnJob *job = context;
+	spawnRange(job->p, job->begin + begin, job->begin + end, job->key);
+}
+
+void spawnParticles(ParticleStore *p, int begin, int end, uint32_t key)
+{
+	SpawnJob job = { p, begin, key };
+	parallelFor(end - begin, PARTICLE_CHUNK_SIZE, spawnChunk, &job);
+}
+
+void respawnParticles(ParticleStore *p, const int *indices, int n, uint32_t key)
+{
+	for (int k = 0; k < n; k++) {
+		spawnOne(p, indices[k], key);
+	}
+}
+
+/*
+	Close the holes at the given sorted indices by sliding each run of survivors
+	down in one block move. Every surviving element moves at most once.
+*/
+static void compactArray(float *values, int count, const int *indices, int n)
+{
+	int write = indices[0];
+	for (int k = 0; k < n; k++) {
+		int runStart = indices[k] + 1;
+		int runEnd = k + 1 < n ? indices[k + 1] : count;
+		memmove(values + write, values + runStart, (size_t)(runEnd - runStart) * sizeof(float));
+		write += runEnd - runStart;
+	}
+}
+
+void retireParticles(ParticleStore *p, const int *indices, int n, bool stable)
+{
+	if (n == 0) {
+		return;
+	}
+
+	if (stable) {
+		// One array at a time keeps each pass streaming through a single buffer.
+		compactArray(p->x, p->count, indices, n);
+		compactArray(p->y, p->count, indices, n);
+		compactArray(p->speed, p->count, indices, n);
+		compactArray(p->size, p->count, indices, n);
+		compactArray(p->transparency, p->count, indices, n);
+		p->count -= n;
+		return;
+	}
+
+	// Walking the holes from the top down means the last particle is never one
+	// that is still waiting to be removed.
+	for (int k = n - 1; k >= 0; k--) {
+		int hole = indices[k];
+		int last = --p->count;
+		p->x[hole] = p->x[last];
+		p->y[hole] = p->y[last];
+		p->speed[hole] = p->speed[last];
+		p->size[hole] = p->size[last];
+		p->transparency[hole] = p->transparency[last];
+	}
+}
+
+#if defined(SIMD_AVX2)
+/*
+	windAt() for eight flakes, given where their cells start. Each cell is
+	loaded whole - u's corners, then v's - and the eight are transposed into
+	one vector per corner, which beats gathering the corners one by one.
+*/
+static inline void windAt8(const float *cells, const int *cell, __m256 tx, __m256 ty, __m256 *u, __m256 *v)
+{
+	__m256 r0 = _mm256_loadu_ps(cells + cell[0]);
+	__m256 r1 = _mm256_loadu_ps(cells + cell[1]);
+	__m256 r2 = _mm256_loadu_ps(cells + cell[2]);
+	__m256 r3 = _mm256_loadu_ps(cells + cell[3]);
+	__m256 r4 = _mm256_loadu_ps(cells + cell[4]);
+	__m256 r5 = _mm256_loadu_ps(cells + cell[5]);
+	__m256 r6 = _mm256_loadu_ps(cells + cell[6]);
+	__m256 r7 = _mm256_loadu_ps(cells + cell[7]);
+
+	__m256 t0 = _mm256_unpacklo_ps(r0, r1);
+	__m256 t1 = _mm256_unpackhi_ps(r0, r1);
+	__m256 t2 = _mm256_unpacklo_ps(r2, r3);
+	__m256 t3 = _mm256_unpackhi_ps(r2, r3);
+	__m256 t4 = _mm256_unpacklo_ps(r4, r5);
+	__m256 t5 = _mm256_unpackhi_ps(r4, r5);
+	__m256 t6 = _mm256_unpacklo_ps(r6, r7);
+	__m256 t7 = _mm256_unpackhi_ps(r6, r7);
+	__m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+	__m256 bottomLeft = _mm256_permute2f128_ps(s0, s4, 0x20);
+	__m256 bottomRight = _mm256_permute2f128_ps(s1, s5, 0x20);
+	__m256 topLeft = _mm256_permute2f128_ps(s2, s6, 0x20);
+	__m256 topRight = _mm256_permute2f128_ps(s3, s7, 0x20);
+	__m256 bottom = _mm256_add_ps(bottomLeft, _mm256_mul_ps(_mm256_sub_ps(bottomRight, bottomLeft), tx));
+	__m256 top = _mm256_add_ps(topLeft, _mm256_mul_ps(_mm256_sub_ps(topRight, topLeft), tx));
+	*u = _mm256_add_ps(bottom, _mm256_mul_ps(_mm256_sub_ps(top, bottom), ty));
+
+	bottomLeft = _mm256_permute2f128_ps(s0, s4, 0x31);
+	bottomRight = _mm256_permute2f128_ps(s1, s5, 0x31);
+	topLeft = _mm256_permute2f128_ps(s2, s6, 0x31);
+	topRight = _mm256_permute2f128_ps(s3, s7, 0x31);
+	bottom = _mm256_add_ps(bottomLeft, _mm256_mul_ps(_mm256_sub_ps(bottomRight, bottomLeft), tx));
+	top = _mm256_add_ps(topLeft, _mm256_mul_ps(_mm256_sub_ps(topRight, topLeft), tx));
+	*v = _mm256_add_ps(bottom, _mm256_mul_ps(_mm256_sub_ps(top, bottom), ty));
+}
+#endif
+
+#if defined(SIMD_SSE2)
+// One component of windAt() for four flakes: their four corners are loaded whole and transposed.
+static inline __m128 windAt4(const float *corners, const int *cell, __m128 tx, __m128 ty)
+{
+	__m128 bottomLeft = _mm_loadu_ps(corners + cell[0]);
+	__m128 bottomRight = _mm_loadu_ps(corners + cell[1]);
+	__m128 topLeft = _mm_loadu_ps(corners + cell[2]);
+	__m128 topRight = _mm_loadu_ps(corners + cell[3]);
+	_MM_TRANSPOSE4_PS(bottomLeft, bottomRight, topLeft, topRight);
+	__m128 bottom = _mm_add_ps(bottomLeft, _mm_mul_ps(_mm_sub_ps(bottomRight, bottomLeft), tx));
+	__m128 top = _mm_add_ps(topLeft, _mm_mul_ps(_mm_sub_ps(topRight, topLeft), tx));
+	return _mm_add_ps(bottom, _mm_mul_ps(_mm_sub_ps(top, bottom), ty));
+}
+#endif
+
+/*
+	The SIMD kernel behind fallParticles() for one range. Landed indices go to
+	landed[begin], ... and their number is returned. Wind is interpolated and
+	columns are found with the same operations as windAt() and snowColumn() in
+	every path, so SIMD and scalar code move the flakes alike and agree on
+	which ones landed.
+*/
+static int fallRange(ParticleStore *p, int begin, int end, const float *wind, float scale, const float *surface)
+{
+	float *x = p->x;
+	float *y = p->y;
+	const float *speed = p->speed;
+	int *landed = p->landed + begin;
+	int landedCount = 0;
+	int i = begin;
+
+#if defined(SIMD_AVX2)
+	__m256 columns8 = _mm256_set1_ps((float)SNOW_COLUMNS);
+	__m256 lastColumn8 = _mm256_set1_ps((float)(SNOW_COLUMNS - 1));
+	__m256 cells8 = _mm256_set1_ps((float)WIND_CELLS);
+	__m256 lastCell8 = _mm256_set1_ps((float)(WIND_CELLS - 1));
+	__m256 scale8 = _mm256_set1_ps(scale);
+	for (; i + 8 <= end; i += 8) {
+		__m256 across = _mm256_loadu_ps(x + i);
+		__m256 height = _mm256_loadu_ps(y + i);
+
+		__m256 fx = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(across, cells8), _mm256_setzero_ps()), cells8);
+		__m256 fy = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(height, cells8), _mm256_setzero_ps()), cells8);
+		__m256i cellX = _mm256_cvttps_epi32(_mm256_min_ps(fx, lastCell8));
+		__m256i cellY = _mm256_cvttps_epi32(_mm256_min_ps(fy, lastCell8));
+		__m256 tx = _mm256_sub_ps(fx, _mm256_cvtepi32_ps(cellX));
+		__m256 ty = _mm256_sub_ps(fy, _mm256_cvtepi32_ps(cellY));
+		int cell[8];
+		__m256i cellIndex = _mm256_add_epi32(_mm256_mullo_epi32(cellY, _mm256_set1_epi32(WIND_CELLS)), cellX);
+		_mm256_storeu_si256((__m256i *)cell, _mm256_mullo_epi32(cellIndex, _mm256_set1_epi32(WIND_CELL_FLOATS)));
+		__m256 gustX, gustY;
+		windAt8(wind, cell, tx, ty, &gustX, &gustY);
+
+		across = _mm256_add_ps(across, _mm256_mul_ps(gustX, scale8));
+		_mm256_storeu_ps(x + i, across);
+		height = _mm256_add_ps(_mm256_sub_ps(height, _mm256_mul_ps(_mm256_loadu_ps(speed + i), scale8)), _mm256_mul_ps(gustY, scale8));
+		_mm256_storeu_ps(y + i, height);
+
+		__m256 column = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(across, columns8), _mm256_setzero_ps()), lastColumn8);
+		__m256 limit = _mm256_i32gather_ps(surface, _mm256_cvttps_epi32(column), 4);
+		unsigned int mask = (unsigned int)_mm256_movemask_ps(_mm256_cmp_ps(height, limit, _CMP_LT_OQ));
+		while (mask != 0) {
+			landed[landedCount++] = i + lowestBit(mask);
+			mask &= mask - 1;
+		}
+	}
+#endif
+
+#if defined(SIMD_SSE2)
+	__m128 columns4 = _mm_set1_ps((float)SNOW_COLUMNS);
+	__m128 lastColumn4 = _mm_set1_ps((float)(SNOW_COLUMNS - 1));
+	__m128 cells4 = _mm_set1_ps((float)WIND_CELLS);
+	__m128 lastCell4 = _mm_set1_ps((float)(WIND_CELLS - 1));
+	__m128 scale4 = _mm_set1_ps(scale);
+	for (; i + 4 <= end; i += 4) {
+		__m128 across = _mm_loadu_ps(x + i);
+		__m128 height = _mm_loadu_ps(y + i);
+
+		__m128 fx = _mm_min_ps(_mm_max_ps(_mm_mul_ps(across, cells4), _mm_setzero_ps()), cells4);
+		__m128 fy = _mm_min_ps(_mm_max_ps(_mm_mul_ps(height, cells4), _mm_setzero_ps()), cells4);
+		__m128i cellX = _mm_cvttps_epi32(_mm_min_ps(fx, lastCell4));
+		__m128i cellY = _mm_cvttps_epi32(_mm_min_ps(fy, lastCell4));
+		__m128 tx = _mm_sub_ps(fx, _mm_cvtepi32_ps(cellX));
+		__m128 ty = _mm_sub_ps(fy, _mm_cvtepi32_ps(cellY));
+		int cx[4], cy[4], cell[4];
+		_mm_storeu_si128((__m128i *)cx, cellX);
+		_mm_storeu_si128((__m128i *)cy, cellY);
+		for (int k = 0; k < 4; k++) {
+			cell[k] = (cy[k] * WIND_CELLS + cx[k]) * WIND_CELL_FLOATS;
+		}
+		__m128 gustX = windAt4(wind, cell, tx, ty);
+		__m128 gustY = windAt4(wind + 4, cell, tx, ty);
+
+		across = _mm_add_ps(across, _mm_mul_ps(gustX, scale4));
+		_mm_storeu_ps(x + i, across);
+		height = _mm_add_ps(_mm_sub_ps(height, _mm_mul_ps(_mm_loadu_ps(speed + i), scale4)), _mm_mul_ps(gustY, scale4));
+		_mm_storeu_ps(y + i, height);
+
+		// The four surfaces are looked up one at a time too.
+		int column[4];
+		_mm_storeu_si128((__m128i *)column, _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(across, columns4), _mm_setzero_ps()), lastColumn4)));
+		__m128 limit = _mm_setr_ps(surface[column[0]], surface[column[1]], surface[column[2]], surface[column[3]]);
+		unsigned int mask = (unsigned int)_mm_movemask_ps(_mm_cmplt_ps(height, limit));
+		while (mask != 0) {
+			landed[landedCount++] = i + lowestBit(mask);
+			mask &= mask - 1;
+		}
+	}
+#endif
+
+	for (; i < end; i++) {
+		float gustX, gustY;
+		windAt(wind, x[i], y[i], &gustX, &gustY);
+		x[i] += gustX * scale;
+		y[i] = y[i] - speed[i] * scale + gustY * scale;
+		if (y[i] < surface[snowColumn(x[i])]) {
+			landed[landedCount++] = i;
+		}
+	}
+
+	return landedCount;
+}
+
+typedef struct {
+	ParticleStore *p;
+	const float *wind;
+	float scale;
+	const float *surface;
+} FallJob;
+
+static void fallChunk(void *context, int begin, int end)
+{
+	FallJob *job = context;
+	job->p->chunkLanded[begin / PARTICLE_CHUNK_SIZE] = fallRange(job->p, begin, end, job->wind, job->scale, job->surface);
+}
+
+int fallParticles(ParticleStore *p, const Wind *wind, float scale, const float *surface)
+{
+	FallJob job = { p, wind->cells[wind->front], scale, surface };
+	parallelFor(p->count, PARTICLE_CHUNK_SIZE, fallChunk, &job);
+
+	// Each chunk wrote its landed indices at its own offset; close the gaps,
+	// in chunk order, so the list comes out the same for any thread count.
+	int chunks = (p->count + PARTICLE_CHUNK_SIZE - 1) / PARTICLE_CHUNK_SIZE;
+	int landedCount = 0;
+	for (int chunk = 0; chunk < chunks; chunk++) {
+		int n = p->chunkLanded[chunk];
+		int offset = chunk * PARTICLE_CHUNK_SIZE;
+		if (n > 0 && offset != landedCount) {
+			memmove(p->landed + landedCount, p->landed + offset, (size_t)n * sizeof(int));
+		}
+		landedCount += n;
+	}
+	return landedCount;
+}
@@ -0,0 +1,137 @@
+/******************************************************************************
+ *
+ * Particle store
+ *
+ * Snow flakes are kept as a structure of arrays: the per-frame update only
+ * reads x, y and speed, so size and transparency stay out of its cache lines.
+ *
+ ******************************************************************************/
+
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wind.h"
+
+// Landing heights are given for this many equal columns across x from 0 to 1.
+#define SNOW_COLUMNS 512
+
+// Particles per chunk when the update is spread over the job threads.
+#define PARTICLE_CHUNK_SIZE 16384
+
+/*
+	Most particles a store will hold. Well under INT_MAX, so counts and indices
+	fit an int and growing the pool never has to go past it.
+*/
+#define MAX_PARTICLES 1000000000
+
+// Flakes come in SNOW_SIZES whole-pixel point sizes starting at SNOW_MIN_SIZE.
+#define SNOW_SIZES 5
+#define SNOW_MIN_SIZE 2
+
+/*
+	A flake's size as a whole number of pixels, and its alpha from 0 to 255.
+	Flakes from a run give their own values back; the ones in a checkpoint are
+	used where they lie without being read at load, so a bad one is held here,
+	where it is drawn, instead of indexing past the size buckets.
+*/
+static inline int flakeSize(float size)
+{
+	if (!(size >= SNOW_MIN_SIZE)) {
+		return SNOW_MIN_SIZE;
+	}
+	if (size > SNOW_MIN_SIZE + SNOW_SIZES - 1) {
+		return SNOW_MIN_SIZE + SNOW_SIZES - 1;
+	}
+	return (int)size;
+}
+
+static inline int flakeAlpha(float transparency)
+{
+	if (!(transparency >= 0.0f)) {
+		return 0;
+	}
+	if (transparency > 1.0f) {
+		return 255;
+	}
+	return (int)(transparency * 255.0f + 0.5f);
+}
+
+typedef struct {
+	float *x;
+	float *y;
+	float *speed;
+	float *size;
+	float *transparency;
+	int *landed;       // scratch indices written by fallParticles()
+	int *chunkLanded;  // landed count per chunk, gathered after the parallel pass
+	int count;
+	int capacity;
+	void *block; // single allocation backing all of the arrays above
+	size_t blockBytes;
+	bool hugePages;
+	bool mapped; // block is part of a file mapping, released with unmapFile()
+} ParticleStore;
+
+/*
+	Reserve room for capacity particles in one page-aligned allocation, backed by
+	large pages if hugePages is set and the OS allows it. Returns false if out of
+	memory or capacity is above MAX_PARTICLES.
+*/
+bool initParticles(ParticleStore *p, int capacity, bool hugePages);
+void freeParticles(ParticleStore *p);
+
+// Bytes initParticles() lays capacity particles out in, before rounding to pages.
+size_t particleLayoutBytes(int capacity);
+
+/*
+	Use mapping, a file mapping of mappingBytes bytes, as p's storage: the
+	arrays for capacity particles lie offset bytes in, laid out as by
+	initParticles(), and the live ones are kept where they are. freeParticles()
+	unmaps the whole mapping.
+*/
+void mapParticles(ParticleStore *p, void *mapping, size_t mappingBytes, size_t offset, int capacity, int count);
+
+/*
+	Make sure the store can hold at least capacity particles, keeping the live
+	ones. Growth at least doubles the pool, up to MAX_PARTICLES, so repeated
+	increases stay cheap. Returns false (leaving the store untouched) if out of
+	memory or capacity is above MAX_PARTICLES.
+*/
+bool reserveParticles(ParticleStore *p, int capacity);
+
+/*
+	Create flakes [begin, end) at the top of the sky: position, size, speed and
+	transparency are drawn from key at each flake's index, so a flake is the
+	same whether it is spawned alone or in a batch. Large batches are spread
+	over the job threads.
+*/
+void spawnParticles(ParticleStore *p, int begin, int end, uint32_t key);
+
+// spawnParticles() for the n flakes listed in indices, e.g. the ones that landed.
+void respawnParticles(ParticleStore *p, const int *indices, int n, uint32_t key);
+
+/*
+	Remove the particles whose indices are listed in ascending order in
+	indices[0..n). With stable the survivors keep their relative order, at the
+	cost of one pass over everything after the first removed index. Otherwise
+	each hole is filled from the end of the store, so the cost is proportional
+	to n alone.
+*/
+void retireParticles(ParticleStore *p, const int *indices, int n, bool stable);
+
+/*
+	Move every particle down by its speed and along with the wind where it is,
+	spread over the job threads. Speeds and wind are per 60 Hz frame; scale is
+	the tick length in frames.
+	A particle has landed once it drops below surface[snowColumn(x)]; the
+	indices of those are written in ascending order to landed[0], landed[1],
+	... and their number is returned. surface isn't written to, so it can only
+	change between calls.
+*/
+int fallParticles(ParticleStore *p, const Wind *wind, float scale, const float *surface);
+
+#endif
@@ -0,0 +1,159 @@
+/******************************************************************************
+ *
+ * Pipelined simulation
+ *
+ ******************************************************************************/
+
+#include "pipeline.h"
+#include "atomics.h"
+#include "control.h"
+#include "platform.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Set in the shared index while its snapshot hasn't been acquired yet.
+#define SNAPSHOT_FRESH 4
+
+static Snapshot snapshots[PIPELINE_SNAPSHOTS];
+static volatile int32_t middle; // the snapshot between the two threads, maybe | SNAPSHOT_FRESH
+static int back;  // being written; only the simulation thread uses it
+static int front; // being drawn; only the render thread uses it
+
+static Scene *simScene;
+static CommandQueue commands;
+static Thread simThread;
+static volatile int32_t running;
+static float simLoad;
+
+/*
+	Copy s into snap, reusing snap's particle arrays. Returns false if they
+	couldn't grow to hold s's particles.
+*/
+static bool takeSnapshot(Snapshot *snap, const Scene *s, uint64_t tickTime)
+{
+	ParticleStore store = snap->scene.snow;
+	if (!reserveParticles(&store, s->snow.count)) {
+		return false;
+	}
+
+	snap->scene = *s;
+	snap->scene.snow = store;
+	size_t bytes = (size_t)s->snow.count * sizeof(float);
+	memcpy(store.x, s->snow.x, bytes);
+	memcpy(store.y, s->snow.y, bytes);
+	memcpy(store.speed, s->snow.speed, bytes);
+	memcpy(store.size, s->snow.size, bytes);
+	memcpy(store.transparency, s->snow.transparency, bytes);
+	snap->scene.snow.count = s->snow.count;
+	snap->tickTime = tickTime;
+	snap->simLoad = simLoad;
+	return true;
+}
+
+static void publishSnapshot(void)
+{
+	back = atomicExchange32(&middle, back | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH;
+}
+
+const Snapshot *acquireSnapshot(void)
+{
+	if (atomicLoad32(&middle) & SNAPSHOT_FRESH) {
+		front = atomicExchange32(&middle, front) & ~SNAPSHOT_FRESH;
+	}
+	return &snapshots[front];
+}
+
+float snapshotAlpha(const Snapshot *snap, uint64_t now)
+{
+	// The snapshot's tick is usually still in the future: interpolate from the
+	// tick before it, and hold the latest if the simulation has fallen behind.
+	float alpha = 1.0f + (float)((int64_t)(now - snap->tickTime)) / snap->scene.tickNs;
+	return alpha < 0.0f ? 0.0f : alpha > 1.0f ? 1.0f : alpha;
+}
+
+bool submitPipelineCommand(Command command)
+{
+	return pushCommand(&commands, command);
+}
+
+static void simulate(void *argument)
+{
+	Scene *s = argument;
+	uint64_t simulated = timeNowNs(); // how far the scene has been advanced
+	traceThreadName("simulation", 0);
+
+	while (atomicLoad32(&running)) {
+		Command command;
+		while (popCommand(&commands, &command)) {
+			applyCommand(s, command);
+		}
+		applyControlCommands(s);
+
+		// Keep one tick ahead of the clock.
+		uint64_t start = timeNowNs();
+		uint32_t firstTick = s->frame;
+		if (start + s->tickNs > simulated) {
+			TRACE_ZONE("advanceScene", advanceScene(s, start + s->tickNs - simulated));
+			simulated = start + s->tickNs;
+		}
+		uint64_t tickTime = simulated - s->pendingNs;
+
+		if (s->frame != firstTick) {
+			bool taken;
+			TRACE_ZONE("takeSnapshot", taken = takeSnapshot(&snapshots[back], s, tickTime));
+			if (taken) {
+				publishSnapshot();
+			}
+			uint64_t busy = timeNowNs() - start;
+			float load = (float)busy / ((s->frame - firstTick) * s->tickNs);
+			simLoad += (load - simLoad) / 8.0f;
+		}
+
+		// The next tick is due once the clock reaches the latest one.
+		uint64_t now = timeNowNs();
+		if (tickTime > now) {
+			sleepNs(tickTime - now);
+		}
+	}
+}
+
+bool startPipeline(Scene *s)
+{
+	for (int i = 0; i < PIPELINE_SNAPSHOTS; i++) {
+		if (!initParticles(&snapshots[i].scene.snow, s->snow.capacity, false)) {
+			fprintf(stderr, "Out of memory reserving %d particles per snapshot\n", s->snow.capacity);
+			return false;
+		}
+	}
+
+	simScene = s;
+	simLoad = 0.0f;
+	takeSnapshot(&snapshots[0], s, timeNowNs());
+	front = 0;
+	middle = 1;
+	back = 2;
+
+	atomicStore32(&running, 1);
+	if (!threadStart(&simThread, simulate, s)) {
+		fprintf(stderr, "Couldn't start the simulation thread\n");
+		atomicStore32(&running, 0);
+		return false;
+	}
+	return true;
+}
+
+void stopPipeline(void)
+{
+	if (simScene == NULL) {
+		return;
+	}
+	atomicStore32(&running, 0);
+	threadJoin(simThread);
+	simScene = NULL;
+
+	for (int i = 0; i < PIPELINE_SNAPSHOTS; i++) {
+		freeParticles(&snapshots[i].scene.snow);
+	}
+}
@@ -0,0 +1,61 @@
+/******************************************************************************
+ *
+ * Pipelined simulation
+ *
+ * With --pipeline the scene is stepped on a thread of its own while the
+ * window's thread draws, so a frame costs the longer of the two rather than
+ * their sum. After each batch of ticks the simulation thread copies the scene
+ * (particles, snow cover, snowman, sun and sky) into a snapshot and publishes
+ * it; the render thread draws the latest snapshot it has acquired.
+ *
+ * There are three snapshots: one being written, one being drawn and one in
+ * between holding the latest finished copy. Publishing and acquiring each
+ * swap a snapshot for the one in between with a single atomic exchange, so
+ * neither side ever waits for the other. The simulation runs one tick ahead
+ * of the clock, so the tick a frame interpolates towards is usually ready
+ * before the frame needs it.
+ *
+ ******************************************************************************/
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "commands.h"
+#include "scene.h"
+
+#define PIPELINE_SNAPSHOTS 3
+
+typedef struct {
+	Scene scene;       // the scene after a tick, with particle arrays of its own
+	uint64_t tickTime; // the moment on timeNowNs()'s clock that tick stands for
+	float simLoad;     // share of its time the simulation thread spends stepping
+} Snapshot;
+
+/*
+	Hand s to a new simulation thread, which steps it in real time until
+	stopPipeline(). Nothing else may touch s meanwhile. Returns false (after
+	printing why) if the snapshots or the thread couldn't be set up.
+*/
+bool startPipeline(Scene *s);
+void stopPipeline(void);
+
+/*
+	Queue a command for the simulation thread, to apply before its next tick.
+	Call from the render thread only. Returns false if the queue is full.
+*/
+bool submitPipelineCommand(Command command);
+
+/*
+	The latest snapshot published. It stays untouched until the next call, and
+	there is always one, from startPipeline() on. Call from the render thread
+	only.
+*/
+const Snapshot *acquireSnapshot(void);
+
+// How far to interpolate into snap's latest tick at time now, for viewScene().
+float snapshotAlpha(const Snapshot *snap, uint64_t now);
+
+#endif
@@ -0,0 +1,505 @@
+/******************************************************************************
+ *
+ * Platform layer
+ *
+ ******************************************************************************/
+
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "platform.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Large pages are 2 MiB on every x64 Linux system we run on.
+#define HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+#endif
+
+uint64_t timeNowNs(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if (frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
+	}
+	QueryPerformanceCounter(&counter);
+
+	// Split the conversion so counter * 1e9 can't overflow.
+	uint64_t seconds = counter.QuadPart / frequency.QuadPart;
+	uint64_t remainder = counter.QuadPart % frequency.QuadPart;
+	return seconds * 1000000000ull + remainder * 1000000000ull / frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+#endif
+}
+
+#ifdef _WIN32
+// Not in older SDK headers; high-resolution timers need Windows 10 1803 or later.
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#endif
+
+void sleepNs(uint64_t ns)
+{
+#ifdef _WIN32
+	/*
+		Sleep() rounds to the scheduler tick; a high-resolution timer doesn't.
+		Each thread has its own, made on its first sleep and kept for its life:
+		setting a shared one would cut short another thread's wait.
+	*/
+	static THREAD_LOCAL HANDLE timer;
+	static THREAD_LOCAL bool timerTried;
+	if (!timerTried) {
+		timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		timerTried = true;
+	}
+
+	if (timer != NULL) {
+		LARGE_INTEGER due;
+		due.QuadPart = -(LONGLONG)((ns + 99) / 100); // relative, in 100 ns units
+		if (SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE)) {
+			WaitForSingleObject(timer, INFINITE);
+			return;
+		}
+	}
+	Sleep((DWORD)(ns / 1000000));
+#else
+	struct timespec duration = { (time_t)(ns / 1000000000ull), (long)(ns % 1000000000ull) };
+	// If a signal interrupts the sleep, carry on with whatever is left.
+	while (nanosleep(&duration, &duration) == -1 && errno == EINTR) {
+	}
+#endif
+}
+
+void *alignedAlloc(size_t size, size_t alignment)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, alignment);
+#else
+	void *memory = NULL;
+	if (posix_memalign(&memory, alignment, size) != 0) {
+		return NULL;
+	}
+	return memory;
+#endif
+}
+
+void alignedFree(void *memory)
+{
+#ifdef _WIN32
+	_aligned_free(memory);
+#else
+	free(memory);
+#endif
+}
+
+void *pageAlloc(size_t *size, bool hugePages)
+{
+#ifdef _WIN32
+	if (hugePages) {
+		// Needs the "Lock pages in memory" privilege; without it this just fails.
+		SIZE_T largePage = GetLargePageMinimum();
+		if (largePage != 0) {
+			SIZE_T rounded = (*size + largePage - 1) & ~(largePage - 1);
+			void *memory = VirtualAlloc(NULL, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (memory != NULL) {
+				*size = rounded;
+				return memory;
+			}
+		}
+	}
+	return VirtualAlloc(NULL, *size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	void *memory;
+	if (hugePages) {
+		*size = (*size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+		memory = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (memory != MAP_FAILED) {
+			return memory;
+		}
+#endif
+	}
+
+	memory = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	if (hugePages) {
+		// No reserved huge pages: ask for transparent ones instead.
+		madvise(memory, *size, MADV_HUGEPAGE);
+	}
+#endif
+	return memory;
+#endif
+}
+
+void pageFree(void *memory, size_t size)
+{
+	if (memory == NULL) {
+		return;
+	}
+#ifdef _WIN32
+	(void)size;
+	VirtualFree(memory, 0, MEM_RELEASE);
+#else
+	munmap(memory, size);
+#endif
+}
+
+void *mapFile(const char *path, size_t *size)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return NULL;
+	}
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = NULL;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+		mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	}
+	CloseHandle(file);
+	if (mapping == NULL) {
+		return NULL;
+	}
+	// The view keeps the mapping alive after its handle is closed.
+	void *memory = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+	if (memory != NULL) {
+		*size = (size_t)fileSize.QuadPart;
+	}
+	return memory;
+#else
+	int file = open(path, O_RDONLY);
+	if (file == -1) {
+		return NULL;
+	}
+	struct stat status;
+	void *memory = MAP_FAILED;
+	if (fstat(file, &status) == 0 && status.st_size > 0) {
+		memory = mmap(NULL, (size_t)status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+	}
+	close(file);
+	if (memory == MAP_FAILED) {
+		return NULL;
+	}
+	*size = (size_t)status.st_size;
+	return memory;
+#endif
+}
+
+void unmapFile(void *memory, size_t size)
+{
+	if (memory == NULL) {
+		return;
+	}
+#ifdef _WIN32
+	(void)size;
+	UnmapViewOfFile(memory);
+#else
+	munmap(memory, size);
+#endif
+}
+
+int cpuCount(void)
+{
+#ifdef _WIN32
+	DWORD count = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+	return count > 0 ? (int)count : 1;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int)count : 1;
+#endif
+}
+
+typedef struct {
+	void (*function)(void *);
+	void *argument;
+} ThreadStart;
+
+#ifdef _WIN32
+static DWORD WINAPI threadEntry(LPVOID start)
+#else
+static void *threadEntry(void *start)
+#endif
+{
+	ThreadStart call = *(ThreadStart *)start;
+	free(start);
+	call.function(call.argument);
+	return 0;
+}
+
+bool threadStart(Thread *thread, void (*function)(void *), void *argument)
+{
+	ThreadStart *start = malloc(sizeof(ThreadStart));
+	if (start == NULL) {
+		return false;
+	}
+	start->function = function;
+	start->argument = argument;
+
+#ifdef _WIN32
+	*thread = CreateThread(NULL, 0, threadEntry, start, 0, NULL);
+	if (*thread == NULL) {
+		free(start);
+		return false;
+	}
+#else
+	if (pthread_create(thread, NULL, threadEntry, start) != 0) {
+		free(start);
+		return false;
+	}
+#endif
+	return true;
+}
+
+void threadJoin(Thread thread)
+{
+#ifdef _WIN32
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread, NULL);
+#endif
+}
+
+void threadYield(void)
+{
+#ifdef _WIN32
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+void mutexInit(Mutex *mutex)
+{
+#ifdef _WIN32
+	InitializeSRWLock(mutex);
+#else
+	pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+void mutexDestroy(Mutex *mutex)
+{
+#ifdef _WIN32
+	// Slim reader/writer locks hold nothing to release.
+	(void)mutex;
+#else
+	pthread_mutex_destroy(mutex);
+#endif
+}
+
+void mutexLock(Mutex *mutex)
+{
+#ifdef _WIN32
+	AcquireSRWLockExclusive(mutex);
+#else
+	pthread_mutex_lock(mutex);
+#endif
+}
+
+void mutexUnlock(Mutex *mutex)
+{
+#ifdef _WIN32
+	ReleaseSRWLockExclusive(mutex);
+#else
+	pthread_mutex_unlock(mutex);
+#endif
+}
+
+void conditionInit(Condition *condition)
+{
+#ifdef _WIN32
+	InitializeConditionVariable(condition);
+#else
+	pthread_cond_init(condition, NULL);
+#endif
+}
+
+void conditionDestroy(Condition *condition)
+{
+#ifdef _WIN32
+	(void)condition;
+#else
+	pthread_cond_destroy(condition);
+#endif
+}
+
+void conditionWait(Condition *condition, Mutex *mutex)
+{
+#ifdef _WIN32
+	SleepConditionVariableSRW(condition, mutex, INFINITE, 0);
+#else
+	pthread_cond_wait(condition, mutex);
+#endif
+}
+
+void conditionWakeAll(Condition *condition)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable(condition);
+#else
+	pthread_cond_broadcast(condition);
+#endif
+}
+
+int localListen(const char *path)
+{
+#ifdef _WIN32
+	(void)path;
+	return -1;
+#else
+	struct sockaddr_un address = { 0 };
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		return -1;
+	}
+	strcpy(address.sun_path, path);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == -1) {
+		return -1;
+	}
+	// A socket file left behind by an earlier run would make bind() fail, so
+	// replace it, but never remove anything that isn't a socket.
+	struct stat existing;
+	if (lstat(path, &existing) == 0) {
+		if (!S_ISSOCK(existing.st_mode)) {
+			close(listener);
+			errno = EEXIST;
+			return -1;
+		}
+		unlink(path);
+	}
+	if (bind(listener, (struct sockaddr *)&address, sizeof(address)) == -1 || listen(listener, 4) == -1) {
+		close(listener);
+		return -1;
+	}
+	return listener;
+#endif
+}
+
+int localAccept(int listener)
+{
+#ifdef _WIN32
+	(void)listener;
+	return -1;
+#else
+	int connection;
+	while ((connection = accept(listener, NULL, NULL)) == -1 && errno == EINTR) {
+	}
+	return connection;
+#endif
+}
+
+int localRead(int connection, char *buffer, int size)
+{
+#ifdef _WIN32
+	(void)connection;
+	(void)buffer;
+	(void)size;
+	return -1;
+#else
+	ssize_t got;
+	while ((got = recv(connection, buffer, (size_t)size, 0)) == -1 && errno == EINTR) {
+	}
+	return (int)got;
+#endif
+}
+
+bool localWrite(int connection, const char *data, int size)
+{
+#ifdef _WIN32
+	(void)connection;
+	(void)data;
+	(void)size;
+	return false;
+#else
+	// A peer that has gone away must not raise SIGPIPE and kill the scene.
+#ifdef MSG_NOSIGNAL
+	int flags = MSG_NOSIGNAL;
+#else
+	int flags = 0;
+#endif
+	while (size > 0) {
+		ssize_t sent = send(connection, data, (size_t)size, flags);
+		if (sent == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		data += sent;
+		size -= (int)sent;
+	}
+	return true;
+#endif
+}
+
+void localClose(int connection)
+{
+#ifdef _WIN32
+	(void)connection;
+#else
+	close(connection);
+#endif
+}
+
+void localRemove(const char *path)
+{
+#ifdef _WIN32
+	(void)path;
+#else
+	struct stat existing;
+	if (lstat(path, &existing) == 0 && S_ISSOCK(existing.st_mode)) {
+		unlink(path);
+	}
+#endif
+}
+
+int readStdin(char *buffer, int size)
+{
+#ifdef _WIN32
+	return _read(0, buffer, (unsigned int)size);
+#else
+	ssize_t got;
+	while ((got = read(STDIN_FILENO, buffer, (size_t)size)) == -1 && errno == EINTR) {
+	}
+	return (int)got;
+#endif
+}
+
+void binaryStdout(void)
+{
+#ifdef _WIN32
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+}
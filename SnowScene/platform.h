@@ -0,0 +1,116 @@
+/******************************************************************************
+ *
+ * Platform layer
+ *
+ * Thin wrappers over the few OS services the scene needs, so the same sources
+ * build on Windows and Linux.
+ *
+ ******************************************************************************/
+
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+typedef HANDLE Thread;
+typedef SRWLOCK Mutex;
+typedef CONDITION_VARIABLE Condition;
+#else
+#include <pthread.h>
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Condition;
+#endif
+
+// Storage class for a variable each thread has its own copy of.
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+// Monotonic clock in nanoseconds (arbitrary origin).
+uint64_t timeNowNs(void);
+
+/*
+	Suspend the calling thread for at least the given number of nanoseconds, at
+	the best resolution the OS offers. It may oversleep by the scheduler's
+	granularity; callers that need precision spin out the last stretch. Safe to
+	call from several threads at once.
+*/
+void sleepNs(uint64_t ns);
+
+// Allocate memory aligned to the given power of two. Release with alignedFree().
+void *alignedAlloc(size_t size, size_t alignment);
+void alignedFree(void *memory);
+
+/*
+	Allocate zeroed, page-aligned memory straight from the OS. With hugePages the
+	allocation is backed by large pages where the OS grants them, falling back to
+	normal pages otherwise. *size is rounded up to the amount actually mapped;
+	pass that value to pageFree().
+*/
+void *pageAlloc(size_t *size, bool hugePages);
+void pageFree(void *memory, size_t size);
+
+/*
+	Map the whole file at path into memory, copy-on-write: the mapping can be
+	written, but writes never reach the file. Pages are read in as they are
+	first touched. Stores the file's size in *size; returns NULL on failure.
+	Release with unmapFile().
+*/
+void *mapFile(const char *path, size_t *size);
+void unmapFile(void *memory, size_t size);
+
+// Number of logical processors available to the process.
+int cpuCount(void);
+
+// Start a thread running function(argument). Returns false on failure.
+bool threadStart(Thread *thread, void (*function)(void *), void *argument);
+void threadJoin(Thread thread);
+void threadYield(void);
+
+void mutexInit(Mutex *mutex);
+// Only once nothing holds the mutex or waits on it.
+void mutexDestroy(Mutex *mutex);
+void mutexLock(Mutex *mutex);
+void mutexUnlock(Mutex *mutex);
+
+void conditionInit(Condition *condition);
+// Only once nothing waits on the condition.
+void conditionDestroy(Condition *condition);
+// Atomically release mutex and wait; mutex is held again on return.
+void conditionWait(Condition *condition, Mutex *mutex);
+void conditionWakeAll(Condition *condition);
+
+/*
+	Local stream sockets (Unix domain sockets), named by a file system path.
+	Not available on Windows, where localListen() always fails. Sockets are
+	plain descriptors; -1 means failure. A socket already at path (left by an
+	earlier run) is replaced, but localListen() fails with errno EEXIST rather
+	than remove anything else.
+*/
+int localListen(const char *path);
+int localAccept(int listener);
+// Returns the number of bytes read, 0 once the peer has closed, -1 on error.
+int localRead(int connection, char *buffer, int size);
+bool localWrite(int connection, const char *data, int size);
+void localClose(int connection);
+// Remove the socket at path, if that is what's there.
+void localRemove(const char *path);
+
+/*
+	Read whatever is available from stdin, up to size bytes, bypassing stdio so
+	a thread blocked here doesn't hold stdin's lock. Returns the number of
+	bytes read, 0 at end of input, -1 on error.
+*/
+int readStdin(char *buffer, int size);
+
+// Stop stdout translating line endings, for streaming binary data through it.
+void binaryStdout(void);
+
+#endif
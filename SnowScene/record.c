@@ -0,0 +1,310 @@
+/******************************************************************************
+ *
+ * Input recording and replay
+ *
+ ******************************************************************************/
+
+#include "record.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+	uint32_t tick;
+	Command command;
+} Recorded;
+
+static FILE *recording;
+static uint32_t lastTick; // tick of the latest record written
+
+static Recorded *replay;
+static int replayCount;
+static int replayNext;
+static uint32_t replayEnd;
+static bool replaying;
+
+static bool hasValue(CommandType type)
+{
+	return type == COMMAND_SET_BUDGET || type == COMMAND_SET_SNOW || type == COMMAND_SCALE_BUDGET;
+}
+
+static void putUint32(unsigned char *out, uint32_t value)
+{
+	out[0] = (unsigned char)value;
+	out[1] = (unsigned char)(value >> 8);
+	out[2] = (unsigned char)(value >> 16);
+	out[3] = (unsigned char)(value >> 24);
+}
+
+static uint32_t getUint32(const unsigned char *in)
+{
+	return in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+// Seven bits per byte, low first; the top bit is set on every byte but the last.
+static int putVarint(unsigned char *out, uint32_t value)
+{
+	int length = 0;
+	while (value >= 0x80) {
+		out[length++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	out[length++] = (unsigned char)value;
+	return length;
+}
+
+static bool getVarint(const unsigned char **in, const unsigned char *end, uint32_t *value)
+{
+	*value = 0;
+	for (int shift = 0; shift < 35 && *in < end; shift += 7) {
+		unsigned char byte = *(*in)++;
+		*value |= (uint32_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool startRecording(const char *path, Config *c)
+{
+	recording = fopen(path, "wb");
+	if (recording == NULL) {
+		fprintf(stderr, "Can't create \"%s\"\n", path);
+		return false;
+	}
+
+	// Seed 0 would pick one from the clock at start-up, where we couldn't see it.
+	if (c->seed == 0) {
+		c->seed = (int)(time(NULL) & 0x7FFFFFFF);
+	}
+
+	unsigned char header[RECORD_HEADER_BYTES];
+	memcpy(header, "SNRC", 4);
+	putUint32(header + 4, RECORD_VERSION);
+	putUint32(header + 8, (uint32_t)c->seed);
+	putUint32(header + 12, (uint32_t)c->tickRate);
+	putUint32(header + 16, (uint32_t)c->particles);
+	putUint32(header + 20, (uint32_t)c->spawnRate);
+	putUint32(header + 24, (uint32_t)c->burst);
+	putUint32(header + 28, c->prefill ? 1 : 0);
+	putUint32(header + 32, c->stableRetire ? 1 : 0);
+	lastTick = 0;
+	if (fwrite(header, 1, sizeof(header), recording) != sizeof(header)) {
+		fprintf(stderr, "Couldn't write \"%s\"\n", path);
+		fclose(recording);
+		recording = NULL;
+		return false;
+	}
+	return true;
+}
+
+static void writeRecord(uint32_t tick, int type, const Command *command)
+{
+	unsigned char record[16];
+	int length = putVarint(record, tick - lastTick);
+	record[length++] = (unsigned char)type;
+	if (command != NULL && hasValue(command->type)) {
+		length += putVarint(record + length, (uint32_t)command->value);
+	}
+	else if (command != NULL && command->type == COMMAND_SET_TIME) {
+		uint32_t bits;
+		memcpy(&bits, &command->time, sizeof(bits));
+		putUint32(record + length, bits);
+		length += 4;
+	}
+	lastTick = tick;
+
+	// Flushed straight away, so a run that crashes still leaves its input.
+	fwrite(record, 1, (size_t)length, recording);
+	fflush(recording);
+}
+
+void recordCommand(const Scene *s, Command command)
+{
+	if (recording != NULL && command.type != COMMAND_SNAPSHOT) {
+		writeRecord(s->frame, command.type, &command);
+	}
+}
+
+void stopRecording(uint32_t tick)
+{
+	if (recording == NULL) {
+		return;
+	}
+	writeRecord(tick, RECORD_END, NULL);
+	bool failed = ferror(recording) != 0;
+	failed = fclose(recording) != 0 || failed;
+	if (failed) {
+		fprintf(stderr, "Couldn't finish the recording\n");
+	}
+	recording = NULL;
+}
+
+// Apply the commands recorded for s's coming tick (sceneTickHook). Recording a
+// replay gives back the same recording.
+static void replayTick(Scene *s)
+{
+	while (replayNext < replayCount && replay[replayNext].tick <= s->frame) {
+		recordCommand(s, replay[replayNext].command);
+		executeCommand(s, replay[replayNext].command);
+		replayNext++;
+	}
+	if (replayNext == replayCount && s->frame >= replayEnd) {
+		replaying = false;
+		sceneTickHook = NULL;
+	}
+}
+
+// Read the commands after the header into replay, which has room for them all.
+static bool parseRecords(const unsigned char *in, const unsigned char *end)
+{
+	uint32_t tick = 0;
+	while (in < end) {
+		uint32_t delta;
+		if (!getVarint(&in, end, &delta) || in == end) {
+			return false;
+		}
+		tick += delta;
+		int type = *in++;
+		if (type == RECORD_END) {
+			replayEnd = tick;
+			break;
+		}
+		if (type > COMMAND_SCALE_BUDGET) {
+			return false;
+		}
+
+		Command command = { (CommandType)type, 0, 0.0f };
+		uint32_t value = 0;
+		// Values are held to what the control channel and the governor can send.
+		if (hasValue(command.type)) {
+			if (!getVarint(&in, end, &value) || value > INT32_MAX
+				|| (command.type == COMMAND_SET_BUDGET && (value == 0 || value > MAX_PARTICLES))
+				|| (command.type == COMMAND_SCALE_BUDGET && (value == 0 || value > BUDGET_SCALE))) {
+				return false;
+			}
+			command.value = (int)value;
+		}
+		else if (command.type == COMMAND_SET_TIME) {
+			if (end - in < 4) {
+				return false;
+			}
+			value = getUint32(in);
+			memcpy(&command.time, &value, sizeof(value));
+			in += 4;
+			if (!isfinite(command.time)) {
+				return false;
+			}
+		}
+		replay[replayCount].tick = tick;
+		replay[replayCount].command = command;
+		replayCount++;
+	}
+	return true;
+}
+
+static bool parseRecording(const unsigned char *data, size_t size, Config *c)
+{
+	if (size < RECORD_HEADER_BYTES || memcmp(data, "SNRC", 4) != 0 || getUint32(data + 4) != RECORD_VERSION) {
+		return false;
+	}
+	uint32_t seed = getUint32(data + 8);
+	uint32_t tickRate = getUint32(data + 12);
+	uint32_t particles = getUint32(data + 16);
+	uint32_t spawnRate = getUint32(data + 20);
+	uint32_t burst = getUint32(data + 24);
+	uint32_t prefill = getUint32(data + 28);
+	uint32_t stableRetire = getUint32(data + 32);
+	if (seed == 0 || seed > INT32_MAX || tickRate == 0 || tickRate > INT32_MAX || particles == 0 || particles > INT32_MAX
+		|| spawnRate > INT32_MAX || burst == 0 || burst > INT32_MAX || prefill > 1
+		|| stableRetire > 1) {
+		return false;
+	}
+
+	// Every record takes at least two bytes.
+	replay = malloc((size - RECORD_HEADER_BYTES) / 2 * sizeof(Recorded) + 1);
+	if (replay == NULL) {
+		return false;
+	}
+	if (!parseRecords(data + RECORD_HEADER_BYTES, data + size)) {
+		free(replay);
+		replay = NULL;
+		replayCount = 0;
+		return false;
+	}
+
+	c->seed = (int)seed;
+	c->tickRate = (int)tickRate;
+	c->particles = (int)particles;
+	c->spawnRate = (int)spawnRate;
+	c->burst = (int)burst;
+	c->prefill = prefill != 0;
+	c->stableRetire = stableRetire != 0;
+	c->fixedDensity = true;
+	return true;
+}
+
+bool startReplay(const char *path, Config *c)
+{
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Can't open recording \"%s\"\n", path);
+		return false;
+	}
+
+	unsigned char *data = NULL;
+	size_t size = 0;
+	size_t capacity = 0;
+	for (;;) {
+		if (size == capacity) {
+			capacity = capacity == 0 ? 4096 : capacity * 2;
+			unsigned char *grown = realloc(data, capacity);
+			if (grown == NULL) {
+				break;
+			}
+			data = grown;
+		}
+		size_t got = fread(data + size, 1, capacity - size, file);
+		size += got;
+		if (got == 0) {
+			break;
+		}
+	}
+	bool readOk = !ferror(file) && feof(file);
+	fclose(file);
+
+	bool ok = readOk && parseRecording(data, size, c);
+	free(data);
+	if (!ok) {
+		fprintf(stderr, "\"%s\" isn't a recording this version can replay\n", path);
+		return false;
+	}
+
+	replaying = true;
+	sceneTickHook = replayTick;
+	return true;
+}
+
+void stopReplay(void)
+{
+	replaying = false;
+	sceneTickHook = NULL;
+	free(replay);
+	replay = NULL;
+	replayCount = 0;
+	replayNext = 0;
+}
+
+bool isReplaying(void)
+{
+	return replaying;
+}
+
+uint32_t replayLength(void)
+{
+	return replayEnd;
+}
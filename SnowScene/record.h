@@ -0,0 +1,75 @@
+/******************************************************************************
+ *
+ * Input recording and replay
+ *
+ * Everything that changes the scene from outside (keys, the density governor,
+ * the control channel) reaches it as a command through applyCommand(), and
+ * everything random derives from the seed. Recording those is enough to
+ * reproduce a run tick for tick, windowed or headless, so A/B timings can be
+ * taken on identical workloads.
+ *
+ * A recording is a header followed by one record per command:
+ *
+ *   header: "SNRC", version, seed, tick rate, particle budget, spawn rate,
+ *           burst size, prefill, stable retire (uint32 LE each)
+ *   record: ticks since the previous record (LEB128), command type (byte),
+ *           then the value (LEB128) or the time (float LE) if it has one
+ *
+ * and, once the run ends, an end record (type RECORD_END) giving its length.
+ *
+ ******************************************************************************/
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "commands.h"
+#include "config.h"
+#include "scene.h"
+
+#define RECORD_VERSION 5
+
+// Bytes before the first record.
+#define RECORD_HEADER_BYTES 36
+
+// Record type marking the end of the run.
+#define RECORD_END 0xFF
+
+/*
+	Start recording to path. Picks a seed now if c has none, so the header can
+	hold it. Returns false (after printing why) if the file can't be created.
+*/
+bool startRecording(const char *path, Config *c);
+
+// Write the end record at tick and close the file.
+void stopRecording(uint32_t tick);
+
+// Append command, applied to s before its next tick. Does nothing unless recording.
+void recordCommand(const Scene *s, Command command);
+
+/*
+	Load a recording made with startRecording() and make c match it: seed, tick
+	rate, particle budget and emitter, with the density governor off. From then on each
+	stepScene() first applies the commands recorded for that tick. Returns
+	false (after printing why) if the file can't be read.
+*/
+bool startReplay(const char *path, Config *c);
+
+/*
+	End a replay where it is, recorded commands or not, and take input from
+	elsewhere again. A replay otherwise ends on the tick after its last one.
+*/
+void stopReplay(void);
+
+/*
+	Whether a replay is still running. Until it ends, commands from anywhere
+	else are ignored. Call from the thread stepping the scene.
+*/
+bool isReplaying(void);
+
+// The recorded run's length in ticks, or 0 if it has no end record.
+uint32_t replayLength(void);
+
+#endif
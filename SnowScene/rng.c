@@ -0,0 +1,34 @@
+/******************************************************************************
+ *
+ * Counter-based random numbers
+ *
+ ******************************************************************************/
+
+#include "rng.h"
+
+void rngFill(uint32_t key, uint32_t first, uint32_t *out, int n)
+{
+	int i = 0;
+
+#if defined(SIMD_AVX2)
+	__m256i key8 = _mm256_set1_epi32((int)key);
+	__m256i index8 = _mm256_add_epi32(_mm256_set1_epi32((int)first), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	for (; i + 8 <= n; i += 8) {
+		_mm256_storeu_si256((__m256i *)(out + i), rngAt8(key8, index8));
+		index8 = _mm256_add_epi32(index8, _mm256_set1_epi32(8));
+	}
+#endif
+
+#if defined(SIMD_SSE2)
+	__m128i key4 = _mm_set1_epi32((int)key);
+	__m128i index4 = _mm_add_epi32(_mm_set1_epi32((int)(first + i)), _mm_setr_epi32(0, 1, 2, 3));
+	for (; i + 4 <= n; i += 4) {
+		_mm_storeu_si128((__m128i *)(out + i), rngAt4(key4, index4));
+		index4 = _mm_add_epi32(index4, _mm_set1_epi32(4));
+	}
+#endif
+
+	for (; i < n; i++) {
+		out[i] = rngAt(key, first + i);
+	}
+}
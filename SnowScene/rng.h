@@ -0,0 +1,139 @@
+/******************************************************************************
+ *
+ * Counter-based random numbers
+ *
+ * Every random number is a pure function of (seed, stream, frame, index): a
+ * per-frame key is derived once from the first three, and each value is a keyed
+ * hash of its index. There is no hidden state, so it doesn't matter how many
+ * threads or SIMD lanes draw numbers, or in which order - particle i always
+ * gets the same value on frame f.
+ *
+ ******************************************************************************/
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+#include "simd.h"
+
+// What a random number is used for. Different uses never share values.
+typedef enum {
+	RNG_GROUND,
+	RNG_WIND,
+	RNG_SPAWN,
+	RNG_PREFILL,
+} RngStream;
+
+// Number of values spawnParticles() draws per flake (x, size, transparency).
+#define RNG_SPAWN_DRAWS 3
+
+/*
+	Derive the key for one stream on one frame. This is the only place the seed
+	is mixed in (splitmix64 finaliser).
+*/
+static inline uint32_t rngKey(uint32_t seed, RngStream stream, uint32_t frame)
+{
+	uint64_t z = ((uint64_t)seed << 32 | frame) + ((uint64_t)stream + 1) * 0x9E3779B97F4A7C15ull;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return (uint32_t)(z ^ (z >> 31));
+}
+
+// Bijective 32-bit mixer ("lowbias32").
+static inline uint32_t rngMix(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7FEB352Du;
+	x ^= x >> 15;
+	x *= 0x846CA68Bu;
+	x ^= x >> 16;
+	return x;
+}
+
+// The random number at index under key.
+static inline uint32_t rngAt(uint32_t key, uint32_t index)
+{
+	return rngMix(rngMix(index ^ key) + key);
+}
+
+/*
+	Map a random number onto [0, n) by taking the high half of value * n,
+	which unlike value % n needs no division in SIMD code.
+*/
+static inline uint32_t rngBelow(uint32_t value, uint32_t n)
+{
+	return (uint32_t)(((uint64_t)value * n) >> 32);
+}
+
+// Write the values at indices first, first + 1, ... first + n - 1 to out.
+void rngFill(uint32_t key, uint32_t first, uint32_t *out, int n);
+
+#if defined(SIMD_SSE2)
+
+// SSE2 has no 32-bit low multiply; build one from the two 32x32->64 products.
+static inline __m128i rngMul4(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128i rngMix4(__m128i x)
+{
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+	x = rngMul4(x, _mm_set1_epi32(0x7FEB352D));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+	x = rngMul4(x, _mm_set1_epi32((int)0x846CA68Bu));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+	return x;
+}
+
+// rngAt() for four indices at once.
+static inline __m128i rngAt4(__m128i key, __m128i index)
+{
+	return rngMix4(_mm_add_epi32(rngMix4(_mm_xor_si128(index, key)), key));
+}
+
+// rngBelow() for four values at once.
+static inline __m128i rngBelow4(__m128i value, uint32_t n)
+{
+	__m128i n4 = _mm_set1_epi32((int)n);
+	__m128i even = _mm_srli_epi64(_mm_mul_epu32(value, n4), 32);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(value, 32), n4);
+	return _mm_or_si128(even, _mm_and_si128(odd, _mm_setr_epi32(0, -1, 0, -1)));
+}
+
+#endif
+
+#if defined(SIMD_AVX2)
+
+static inline __m256i rngMix8(__m256i x)
+{
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+	x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7FEB352D));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+	x = _mm256_mullo_epi32(x, _mm256_set1_epi32((int)0x846CA68Bu));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+	return x;
+}
+
+// rngAt() for eight indices at once.
+static inline __m256i rngAt8(__m256i key, __m256i index)
+{
+	return rngMix8(_mm256_add_epi32(rngMix8(_mm256_xor_si256(index, key)), key));
+}
+
+// rngBelow() for eight values at once.
+static inline __m256i rngBelow8(__m256i value, uint32_t n)
+{
+	__m256i n8 = _mm256_set1_epi32((int)n);
+	__m256i even = _mm256_srli_epi64(_mm256_mul_epu32(value, n8), 32);
+	__m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(value, 32), n8);
+	return _mm256_blend_epi32(even, odd, 0xAA);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,402 @@
+/******************************************************************************
+ *
+ * Scene state and simulation
+ *
+ ******************************************************************************/
+
+#include "scene.h"
+#include "geometry.h"
+#include "rng.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+Colour WHITE = { 255, 255, 255 };
+Colour GREY = { 130, 151, 173 };
+Colour BLACK = { 0, 0, 0 };
+Colour ORANGE = { 245, 127, 42 };
+Colour YELLOW = { 241, 221, 24 };
+Colour DARKBLUE = { 6, 130, 195 };
+Colour LIGHTBLUE = { 118, 186, 251 };
+
+Scene scene;
+
+void (*sceneTickHook)(Scene *s) = NULL;
+
+/*
+	Height of the ground's top edge at x, along the lines between its vertices.
+*/
+static float groundHeight(const Scene *s, float x)
+{
+	const Point *v = s->groundVertices;
+	for (int i = 0; i < 3; i++) {
+		if (x <= v[i + 1].x || i == 2) {
+			float t = (x - v[i].x) / (v[i + 1].x - v[i].x);
+			return v[i].y + (v[i + 1].y - v[i].y) * t;
+		}
+	}
+	return v[3].y;
+}
+
+/*
+	Fill in what landing snow lies on in each column - the top of the snowman
+	where it stands above the ground, the ground elsewhere - and clear the
+	cover.
+*/
+static void shapeSnowCover(Scene *s)
+{
+	SnowCover *cover = &s->cover;
+	cover->liftBegin = SNOW_COLUMNS;
+	cover->liftEnd = 0;
+	cover->lift = s->snowmanOffset;
+
+	for (int column = 0; column < SNOW_COLUMNS; column++) {
+		float x = (column + 0.5f) / SNOW_COLUMNS;
+		float ground = groundHeight(s, x);
+		float top = ground;
+		for (int i = 0; i < 6; i++) {
+			const Snowman *part = &s->snowman[i];
+			float dx = x - part->cx;
+			if (fabsf(dx) < part->r) {
+				float height = part->cy + sqrtf(part->r * part->r - dx * dx);
+				top = height > top ? height : top;
+			}
+		}
+
+		cover->base[column] = top;
+		if (top > ground) {
+			cover->liftBegin = column < cover->liftBegin ? column : cover->liftBegin;
+			cover->liftEnd = column + 1;
+		}
+	}
+
+	clearSnowCover(cover);
+}
+
+/*
+	60 Hz frames into the day/night cycle after the given number of ticks, in
+	double precision so that it stays exact over long runs.
+*/
+static double dayFrames(const Scene *s, double ticks)
+{
+	double frames = s->dayStart + ticks * s->tickScale;
+	return frames - floor(frames / DAY_FRAMES) * DAY_FRAMES;
+}
+
+static void applyDaylight(Scene *s, double frames)
+{
+	Daylight daylight = daylightAt((float)(frames / DAY_FRAMES));
+	s->sun = daylight.sun;
+	s->skyTop = daylight.skyTop;
+	s->skyBottom = daylight.skyBottom;
+	s->dayTime = daylight.dayTime;
+}
+
+float timeOfDay(const Scene *s)
+{
+	return (float)(dayFrames(s, s->frame) / DAY_FRAMES);
+}
+
+void setTimeOfDay(Scene *s, float time)
+{
+	double frames = (time - floor(time)) * DAY_FRAMES;
+	s->dayStart = frames - (double)s->frame * s->tickScale;
+	s->dayStart -= floor(s->dayStart / DAY_FRAMES) * DAY_FRAMES;
+	applyDaylight(s, frames);
+}
+
+/*
+	Height of the sun at x: it used to rise 0.5 per unit of x up to 0.4 and
+	0.05 up to 0.5, then sink the same way.
+*/
+static float sunHeight(float x)
+{
+	if (x < 0.4f) {
+		return 0.7f + 0.5f * x;
+	}
+	if (x < 0.5f) {
+		return 0.9f + 0.05f * (x - 0.4f);
+	}
+	if (x < 0.6f) {
+		return 0.905f - 0.05f * (x - 0.5f);
+	}
+	return 0.9f - 0.5f * (x - 0.6f);
+}
+
+/*
+	The sky at time, worked out in full: the day's (or night's) colours until
+	the sun (or moon) passes x = 0.9, then fading towards the other's, closing
+	1/50 of the gap every 60 Hz frame.
+*/
+static void skyAt(float time, Colour *top, Colour *bottom)
+{
+	bool day = time < 0.5f;
+	float x = (day ? time : time - 0.5f) * DAY_FRAMES * SUN_SPEED;
+	*top = day ? DARKBLUE : BLACK;
+	*bottom = day ? LIGHTBLUE : GREY;
+	if (x > 0.9f) {
+		float faded = 1.0f - powf(49.0f / 50.0f, (x - 0.9f) / SUN_SPEED);
+		*top = fadeColor(*top, day ? BLACK : DARKBLUE, faded);
+		*bottom = fadeColor(*bottom, day ? GREY : LIGHTBLUE, faded);
+	}
+}
+
+// skyAt() every 1 / SKY_STEPS of the cycle, with the start repeated at the end.
+static Colour skyTopTable[SKY_STEPS + 1];
+static Colour skyBottomTable[SKY_STEPS + 1];
+static bool skyTableBuilt;
+
+static void buildSkyTable(void)
+{
+	if (skyTableBuilt) {
+		return;
+	}
+	for (int i = 0; i < SKY_STEPS; i++) {
+		skyAt((float)i / SKY_STEPS, &skyTopTable[i], &skyBottomTable[i]);
+	}
+	skyTopTable[SKY_STEPS] = skyTopTable[0];
+	skyBottomTable[SKY_STEPS] = skyBottomTable[0];
+	skyTableBuilt = true;
+}
+
+Daylight daylightAt(float time)
+{
+	buildSkyTable();
+
+	Daylight d;
+	time -= floorf(time);
+	d.dayTime = time < 0.5f;
+	d.sun.x = (d.dayTime ? time : time - 0.5f) * DAY_FRAMES * SUN_SPEED;
+	d.sun.y = sunHeight(d.sun.x);
+	d.sun.colour = d.dayTime ? YELLOW : WHITE;
+
+	float step = time * SKY_STEPS;
+	int i = (int)step;
+	i = i < SKY_STEPS ? i : SKY_STEPS - 1;
+	d.skyTop = fadeColor(skyTopTable[i], skyTopTable[i + 1], step - i);
+	d.skyBottom = fadeColor(skyBottomTable[i], skyBottomTable[i + 1], step - i);
+	return d;
+}
+
+/*
+	Set up the particle pool, ground, snowman, sun and sky.
+*/
+void initScene(Scene *s, const Config *c)
+{
+	int capacity = c->capacity > c->particles ? c->capacity : c->particles;
+	if (capacity > MAX_PARTICLES) {
+		fprintf(stderr, "Can't keep more than %d particles, asked for %d\n", MAX_PARTICLES, capacity);
+		exit(1);
+	}
+	if (s->snow.block == NULL && !initParticles(&s->snow, capacity, c->hugePages)) {
+		fprintf(stderr, "Out of memory reserving %d particles\n", capacity);
+		exit(1);
+	}
+	s->snow.count = 0;
+	s->particleBudget = c->particles;
+	s->baseBudget = c->particles;
+	s->budgetScale = BUDGET_SCALE;
+	s->seed = c->seed != 0 ? (uint32_t)c->seed : (uint32_t)time(NULL);
+	s->frame = 0;
+	s->timeJumping = 0.0f;
+	s->tickNs = 1000000000ull / (uint64_t)c->tickRate;
+	s->tickScale = (float)REFERENCE_RATE / c->tickRate;
+	s->dayStart = 0.0;
+	s->pendingNs = 0;
+	initEmitter(&s->emitter, c);
+	initWind(&s->wind, s->seed);
+	s->snowFall = false;
+	s->stableRetire = c->stableRetire;
+	s->jumping = false;
+
+	// Ground
+	uint32_t ground[3];
+	rngFill(rngKey(s->seed, RNG_GROUND, 0), 0, ground, 3);
+
+	s->groundVertices[0].x = 0.0f;
+	s->groundVertices[0].y = 0.200f;
+	s->groundVertices[1].x = ground[0] % 100 / 1000.0f + 0.050f;
+	s->groundVertices[1].y = ground[1] % 100 / 1000.0f + 0.250f;
+	s->groundVertices[2].x = 1.0f - ground[2] % 100 / 1000.0f - 0.050f;
+	s->groundVertices[2].y = s->groundVertices[1].y;
+	s->groundVertices[3].x = 1.0f;
+	s->groundVertices[3].y = 0.200f;
+
+
+	// Snowman
+	Snowman bottom = { 0.500f, 0.300f, 0.100f, CIRCLE_AUTO_SEGMENTS, WHITE, GREY };
+	Snowman mid = { 0.500f, 0.420f, 0.080f, CIRCLE_AUTO_SEGMENTS, WHITE, GREY };
+	Snowman top = { 0.500f, 0.520f, 0.060f, CIRCLE_AUTO_SEGMENTS, WHITE, GREY };
+	Snowman lEye = { 0.480f, 0.550f, 0.010f, CIRCLE_AUTO_SEGMENTS, BLACK, BLACK };
+	Snowman rEye = { 0.520f, 0.550f, 0.010f, CIRCLE_AUTO_SEGMENTS, BLACK, BLACK };
+	Snowman nose = { 0.500f, 0.520f, 0.012f, 7, ORANGE, ORANGE };
+
+	s->snowman[0] = bottom;
+	s->snowman[1] = mid;
+	s->snowman[2] = top;
+	s->snowman[3] = lEye;
+	s->snowman[4] = rEye;
+	s->snowman[5] = nose;
+	s->snowmanOffset = 0.0f;
+
+	shapeSnowCover(s);
+
+	// Built here too, before any other thread can draw the scene.
+	buildSkyTable();
+	setTimeOfDay(s, 0.0f);
+	s->previousSnowmanOffset = s->snowmanOffset;
+}
+
+/*
+	Change how many flakes the scene keeps alive, growing the pool if needed.
+	Flakes beyond a lowered budget are dropped straight away. Returns false if
+	the pool could not grow.
+*/
+bool setParticleBudget(Scene *s, int budget)
+{
+	if (!reserveParticles(&s->snow, budget)) {
+		return false;
+	}
+	if (s->snow.count > budget) {
+		s->snow.count = budget;
+	}
+	s->particleBudget = budget;
+	return true;
+}
+
+/*
+	Height of the snowman t frames into a jump. It used to climb
+	maxHeight * (1 - (2u - 1)^2) per frame, u being the fraction of the jump
+	gone, then fall the same way; this is that climb integrated over time, so
+	the jump keeps its shape at any tick length.
+*/
+static float jumpHeight(float t)
+{
+	float maxHeight = 0.008f;
+	float u = t / JUMP_TIME;
+	float climbed = 4.0f * maxHeight * JUMP_TIME * (u * u / 2.0f - u * u * u / 3.0f);
+	if (u <= 0.5f) {
+		return climbed;
+	}
+
+	// Past the top, fall as far again as was climbed after it.
+	float peak = maxHeight * JUMP_TIME / 3.0f;
+	return 2.0f * peak - climbed;
+}
+
+/*
+	Advance the scene by one tick.
+*/
+void stepScene(Scene *s)
+{
+	if (sceneTickHook != NULL) {
+		sceneTickHook(s);
+	}
+
+	s->previousSnowmanOffset = s->snowmanOffset;
+
+	//Snow
+	ParticleStore *snow = &s->snow;
+	s->spawnKey = rngKey(s->seed, RNG_SPAWN, s->frame);
+
+	if (s->snowFall) {
+		emitSnow(&s->emitter, snow, s->particleBudget, s->tickScale, s->cover.surface,
+			s->spawnKey, rngKey(s->seed, RNG_PREFILL, s->frame));
+	}
+
+	stepWind(&s->wind, s->tickScale);
+	int landedCount = fallParticles(snow, &s->wind, s->tickScale, s->cover.surface);
+	s->landedCount = landedCount;
+
+	// Settle the landed flakes one at a time, in index order, now that the
+	// parallel pass is done with the surface.
+	for (int i = 0; i < landedCount; i++) {
+		int flake = snow->landed[i];
+		depositSnow(&s->cover, snow->x[flake], flakeSize(snow->size[flake]) * SNOW_FLAKE_DEPTH);
+	}
+
+	if (s->snowFall) {
+		respawnParticles(snow, snow->landed, landedCount, s->spawnKey);
+	}
+
+	// With the snow switched off, landed flakes are retired instead.
+	if (!s->snowFall) {
+		retireParticles(snow, snow->landed, landedCount, s->stableRetire);
+	}
+
+	//Jumping
+	if (s->jumping) {
+		s->timeJumping += s->tickScale;
+		if (s->timeJumping < JUMP_TIME) {
+			s->snowmanOffset = jumpHeight(s->timeJumping);
+		}
+		else {
+			s->timeJumping = 0.0f;
+			s->snowmanOffset = 0.0f;
+			s->jumping = false;
+		}
+		liftSnowCover(&s->cover, s->snowmanOffset);
+	}
+
+	//Sun and sky
+	applyDaylight(s, dayFrames(s, s->frame + 1.0));
+
+	s->frame++;
+}
+
+/*
+	Run as many ticks as fit in the time since the last call (plus what was left
+	over then) and return how far the scene is into the next tick, from 0 to 1,
+	for viewScene().
+*/
+float advanceScene(Scene *s, uint64_t elapsedNs)
+{
+	s->pendingNs += elapsedNs;
+	if (s->pendingNs > MAX_TICKS_PER_FRAME * s->tickNs) {
+		s->pendingNs = MAX_TICKS_PER_FRAME * s->tickNs;
+	}
+
+	while (s->pendingNs >= s->tickNs) {
+		stepScene(s);
+		s->pendingNs -= s->tickNs;
+	}
+	return (float)s->pendingNs / s->tickNs;
+}
+
+static float mix(float from, float to, float alpha)
+{
+	return from + (to - from) * alpha;
+}
+
+/*
+	The scene alpha of the way from the state before the latest tick to the
+	latest, so motion looks smooth at any ratio of frame rate to tick rate.
+	The sun and sky are worked out for that very moment.
+	Flakes are moved back up along their fall instead of keeping a copy of the
+	previous positions; that leaves out the wind's part of the tick.
+*/
+SceneView viewScene(const Scene *s, float alpha)
+{
+	SceneView view;
+
+	// The moment alpha of the way through the latest tick.
+	double ticks = s->frame > 0 ? s->frame - 1.0 + alpha : 0.0;
+	Daylight daylight = daylightAt((float)(dayFrames(s, ticks) / DAY_FRAMES));
+	view.sun = daylight.sun;
+	view.skyTop = daylight.skyTop;
+	view.skyBottom = daylight.skyBottom;
+
+	view.snowmanOffset = mix(s->previousSnowmanOffset, s->snowmanOffset, alpha);
+	view.snowRise = (1.0f - alpha) * s->tickScale;
+	return view;
+}
+
+Colour fadeColor(Colour start, Colour end, float amount) {
+	Colour result;
+	result.r = start.r + (end.r - start.r) * amount;
+	result.g = start.g + (end.g - start.g) * amount;
+	result.b = start.b + (end.b - start.b) * amount;
+	return result;
+}
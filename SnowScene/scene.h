@@ -0,0 +1,159 @@
+/******************************************************************************
+ *
+ * Scene state and simulation
+ *
+ * Everything think() advances lives here, with no dependency on GLUT or OpenGL,
+ * so the simulation can be stepped without a window.
+ *
+ ******************************************************************************/
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "emitter.h"
+#include "particles.h"
+#include "snowcover.h"
+#include "wind.h"
+
+#include "config.h"
+
+// Jump length, in 60 Hz frames.
+#define JUMP_TIME 49
+
+/*
+	The scene was written to advance once per frame at 60 Hz, and its speeds and
+	step sizes are still given per 60 Hz frame. stepScene() advances one tick of
+	1 / tickRate seconds and scales every step by the tick's length in frames, so
+	the visible timing doesn't depend on the tick rate.
+*/
+#define REFERENCE_RATE 60
+#define DEFAULT_TICK_RATE 60
+
+// Most ticks run to catch up on one frame; beyond that the scene slows down
+// rather than falling ever further behind.
+#define MAX_TICKS_PER_FRAME 8
+
+// The sun crosses from x = 0 to SUN_TRAVEL each day, and the moon each night,
+// at SUN_SPEED a 60 Hz frame, so a day and a night take DAY_FRAMES together.
+#define SUN_TRAVEL 1.1f
+#define SUN_SPEED 0.001f
+#define DAY_FRAMES 2200
+
+// The sky's colours are tabulated at this many times of day.
+#define SKY_STEPS 1024
+
+typedef struct {
+	float x, y;
+} Point;
+
+typedef struct {
+	float r, g, b;
+} Colour;
+
+typedef struct {
+	float cx, cy, r;
+	int segments;
+	Colour inner, outer;
+} Snowman;
+
+typedef struct {
+	float x, y;
+	Colour colour;
+} Sun;
+
+// The sun (or moon) and sky at one time of day.
+typedef struct {
+	Sun sun;
+	Colour skyTop;
+	Colour skyBottom;
+	bool dayTime;
+} Daylight;
+
+// budgetScale that keeps the whole base budget.
+#define BUDGET_SCALE 1000000
+
+typedef struct {
+	Point groundVertices[4];
+	ParticleStore snow;
+	SnowCover cover;     // snow that has landed on the ground and the snowman
+	int particleBudget; // number of flakes kept alive while snow is falling
+	int baseBudget;     // the budget asked for, before the density governor scales it
+	int budgetScale;    // how much of baseBudget the governor keeps, in BUDGET_SCALE units
+	Snowman snowman[6];  // parts at rest; the whole snowman is drawn raised by snowmanOffset
+	float snowmanOffset; // current jump height
+	Sun sun;             // the sun, sky and dayTime are daylightAt() the latest tick
+	Colour skyTop;
+	Colour skyBottom;
+	uint32_t seed;
+	uint32_t frame;    // ticks stepped so far; selects this tick's random numbers
+	uint32_t spawnKey; // key new flakes are drawn from on the current tick
+	float timeJumping; // 60 Hz frames into the current jump
+
+	uint64_t tickNs;   // simulated time per stepScene()
+	float tickScale;   // tick length in 60 Hz frames
+	double dayStart;   // 60 Hz frames into the day/night cycle at frame 0
+	uint64_t pendingNs; // time advanceScene() has yet to simulate
+	Emitter emitter;   // adds flakes while snow is falling
+	Wind wind;         // blows the falling flakes about
+	int landedCount;   // flakes that landed on the latest tick
+
+	// The state before the latest tick, to interpolate from. The sun and sky
+	// need none: viewScene() works them out for any moment.
+	float previousSnowmanOffset;
+
+	bool snowFall;
+	bool stableRetire; // keep draw order when landed flakes are removed
+	bool jumping;
+	bool dayTime;
+} Scene;
+
+// What to draw: the scene part of the way from its previous tick to its latest.
+typedef struct {
+	Sun sun;
+	float snowmanOffset;
+	Colour skyTop;
+	Colour skyBottom;
+	float snowRise; // draw each flake this many multiples of its speed above its y
+} SceneView;
+
+extern Colour WHITE;
+extern Colour GREY;
+extern Colour BLACK;
+extern Colour ORANGE;
+extern Colour YELLOW;
+extern Colour DARKBLUE;
+extern Colour LIGHTBLUE;
+
+// The scene shown by the window (or stepped by the headless runner).
+extern Scene scene;
+
+// Called at the start of every stepScene() if set, e.g. to replay recorded input.
+extern void (*sceneTickHook)(Scene *s);
+
+void initScene(Scene *s, const Config *c);
+bool setParticleBudget(Scene *s, int budget);
+void stepScene(Scene *s);
+float advanceScene(Scene *s, uint64_t elapsedNs);
+SceneView viewScene(const Scene *s, float alpha);
+
+/*
+	Time of day as a fraction of the day/night cycle: 0 is sunrise, 0.5 is
+	moonrise. setTimeOfDay() moves the sun (or moon) and sky straight there.
+*/
+float timeOfDay(const Scene *s);
+void setTimeOfDay(Scene *s, float time);
+
+/*
+	The sun (or moon) and sky at time, a fraction of the cycle as above (any
+	value; whole cycles are dropped). The sun's arc is a closed form and the
+	sky a lookup in a table built on first use, so every time costs the same
+	and nothing has to be stepped to get there. initScene() builds the table,
+	so after it any thread may call this; before it, only one.
+*/
+Daylight daylightAt(float time);
+Colour fadeColor(Colour start, Colour end, float amount);
+
+#endif
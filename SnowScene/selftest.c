@@ -0,0 +1,333 @@
+/******************************************************************************
+ *
+ * Self-test
+ *
+ ******************************************************************************/
+
+#include "selftest.h"
+#include "checkpoint.h"
+#include "commands.h"
+#include "headless.h"
+#include "jobs.h"
+#include "record.h"
+#include "scene.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// Enough flakes for several parallelFor() chunks, and ticks for many to land.
+#define TEST_PARTICLES 100000
+#define TEST_TICKS 400
+#define TEST_SEED 20211225
+
+// Scratch files in the working directory, removed afterwards.
+#define TEST_RECORDING "selftest.rec"
+#define TEST_CHECKPOINT "selftest.ckpt"
+
+// The checkpoint check saves at this tick, with the snowman part way through a jump.
+#define CHECKPOINT_TICK 200
+#define CHECKPOINT_JUMP_TICK 190
+
+/*
+	The daylight check compares every DAYLIGHT_SAMPLE 60 Hz frames of a whole
+	day, starting half a sample in so no comparison lands on sunrise or
+	moonrise, at 60 Hz and at DAYLIGHT_FAST_RATE (which has to divide evenly).
+*/
+#define DAYLIGHT_PARTICLES 1000
+#define DAYLIGHT_SAMPLE 100
+#define DAYLIGHT_FAST_RATE 144
+
+// Frames into a day or night before the old sky started to fade (x = 0.9).
+#define OLD_FADE_FRAME 900
+
+/*
+	How far apart the sun (in window sizes) and the sky (0-255) may be. The sky
+	table is linear between entries about two frames apart, so it rounds off
+	the corner where the fade starts and the jump at sunrise and moonrise.
+*/
+#define SUN_TOLERANCE 0.001f
+#define SKY_TOLERANCE 2.0f
+
+// Input for the replay check: one of every command that changes the scene.
+static const struct {
+	int tick;
+	Command command;
+} script[] = {
+	{ 50, { COMMAND_JUMP, 0, 0.0f } },
+	{ 100, { COMMAND_SET_BUDGET, TEST_PARTICLES / 2, 0.0f } },
+	{ 150, { COMMAND_SET_TIME, 0, 0.45f } },
+	{ 200, { COMMAND_SCALE_BUDGET, BUDGET_SCALE / 2, 0.0f } },
+	{ 250, { COMMAND_TOGGLE_SNOW, 0, 0.0f } },
+	{ 300, { COMMAND_SET_SNOW, 1, 0.0f } },
+};
+#define SCRIPT_LENGTH (int)(sizeof(script) / sizeof(script[0]))
+
+// Scenes are large (the wind field), so they live here rather than on the stack.
+static Scene first;
+static Scene second;
+
+// Set when a scene ends without flakes: comparing it would test nothing.
+static bool sawEmptyScene;
+
+// Set up s from c with the snow falling, as runHeadless() starts it.
+static void startTestScene(Scene *s, const Config *c)
+{
+	initScene(s, c);
+	Command startSnow = { COMMAND_SET_SNOW, 1, 0.0f };
+	applyCommand(s, startSnow);
+}
+
+static void stepTicks(Scene *s, int ticks)
+{
+	for (int i = 0; i < ticks; i++) {
+		stepScene(s);
+	}
+}
+
+// Free s, returning its state checksum.
+static uint32_t endTestScene(Scene *s)
+{
+	if (s->snow.count == 0) {
+		sawEmptyScene = true;
+	}
+	uint32_t checksum = stateChecksum(s);
+	freeParticles(&s->snow);
+	memset(s, 0, sizeof(*s));
+	return checksum;
+}
+
+static bool report(const char *name, uint32_t expected, uint32_t got)
+{
+	if (sawEmptyScene) {
+		sawEmptyScene = false;
+		printf("FAIL %s: a scene had no flakes to compare\n", name);
+		return false;
+	}
+	if (got == expected) {
+		printf("PASS %s\n", name);
+		return true;
+	}
+	printf("FAIL %s: checksum %08x, expected %08x\n", name, got, expected);
+	return false;
+}
+
+// The particle update gives the same scene whatever the number of threads.
+static bool checkThreads(const Config *c)
+{
+	static const int threadCounts[2] = { 1, 4 };
+	uint32_t sums[2];
+	for (int k = 0; k < 2; k++) {
+		shutdownJobs();
+		if (!initJobs(threadCounts[k])) {
+			printf("FAIL threads: couldn't start %d threads\n", threadCounts[k]);
+			return false;
+		}
+		startTestScene(&first, c);
+		stepTicks(&first, TEST_TICKS);
+		sums[k] = endTestScene(&first);
+	}
+	return report("threads", sums[0], sums[1]);
+}
+
+// Replaying a recorded run, commands and all, ends in the same scene.
+static bool checkReplay(const Config *c)
+{
+	Config recorded = *c;
+	if (!startRecording(TEST_RECORDING, &recorded)) {
+		printf("FAIL replay: couldn't record\n");
+		return false;
+	}
+	startTestScene(&first, &recorded);
+	int next = 0;
+	for (int tick = 0; tick < TEST_TICKS; tick++) {
+		while (next < SCRIPT_LENGTH && script[next].tick == tick) {
+			applyCommand(&first, script[next++].command);
+		}
+		stepScene(&first);
+	}
+	stopRecording(first.frame);
+	uint32_t expected = endTestScene(&first);
+
+	Config replayed = *c;
+	bool started = startReplay(TEST_RECORDING, &replayed);
+	remove(TEST_RECORDING);
+	if (!started) {
+		printf("FAIL replay: couldn't load the recording\n");
+		return false;
+	}
+	startTestScene(&first, &replayed);
+	stepTicks(&first, (int)replayLength());
+	stopReplay();
+	uint32_t got = endTestScene(&first);
+	return report("replay", expected, got);
+}
+
+// Saving a scene and loading it again changes nothing the next ticks depend on.
+static bool checkCheckpoint(const Config *c)
+{
+	Command jump = { COMMAND_JUMP, 0, 0.0f };
+	startTestScene(&first, c);
+	stepTicks(&first, CHECKPOINT_JUMP_TICK);
+	applyCommand(&first, jump);
+	stepTicks(&first, TEST_TICKS - CHECKPOINT_JUMP_TICK);
+	uint32_t expected = endTestScene(&first);
+
+	startTestScene(&first, c);
+	stepTicks(&first, CHECKPOINT_JUMP_TICK);
+	applyCommand(&first, jump);
+	stepTicks(&first, CHECKPOINT_TICK - CHECKPOINT_JUMP_TICK);
+	bool saved = saveCheckpoint(&first, TEST_CHECKPOINT);
+	endTestScene(&first);
+	if (!saved || !loadCheckpoint(&first, c, TEST_CHECKPOINT)) {
+		remove(TEST_CHECKPOINT);
+		printf("FAIL checkpoint: couldn't save and load the scene\n");
+		return false;
+	}
+	stepTicks(&first, TEST_TICKS - CHECKPOINT_TICK);
+
+	// The particles are mapped from the file, which Windows won't remove until they are released.
+	uint32_t got = endTestScene(&first);
+	remove(TEST_CHECKPOINT);
+	return report("checkpoint", expected, got);
+}
+
+static bool closeColour(Colour a, Colour b)
+{
+	return fabsf(a.r - b.r) <= SKY_TOLERANCE && fabsf(a.g - b.g) <= SKY_TOLERANCE && fabsf(a.b - b.b) <= SKY_TOLERANCE;
+}
+
+static bool sameDaylight(const Daylight *a, const Daylight *b)
+{
+	return a->dayTime == b->dayTime
+		&& fabsf(a->sun.x - b->sun.x) <= SUN_TOLERANCE && fabsf(a->sun.y - b->sun.y) <= SUN_TOLERANCE
+		&& closeColour(a->sun.colour, b->sun.colour)
+		&& closeColour(a->skyTop, b->skyTop) && closeColour(a->skyBottom, b->skyBottom);
+}
+
+static Daylight shownBy(const Scene *s)
+{
+	Daylight d = { s->sun, s->skyTop, s->skyBottom, s->dayTime };
+	return d;
+}
+
+/*
+	The sun and sky as they used to be worked out, a 60 Hz frame at a time:
+	the sun climbing and sinking by fixed steps, and the sky closing 1/50 of
+	its distance to the other half's colours each frame once x passes 0.9.
+	frame is the frame being stepped to. The fade starts on a whole frame:
+	adding up x lands it either side of 0.9 by rounding alone.
+*/
+static void stepOldDaylight(Daylight *d, int frame)
+{
+	if (frame % (DAY_FRAMES / 2) == 0) {
+		d->dayTime = frame % DAY_FRAMES == 0;
+		d->sun.x = 0.0f;
+		d->sun.y = 0.7f;
+		d->sun.colour = d->dayTime ? YELLOW : WHITE;
+		d->skyTop = d->dayTime ? DARKBLUE : BLACK;
+		d->skyBottom = d->dayTime ? LIGHTBLUE : GREY;
+		return;
+	}
+
+	d->sun.x += SUN_SPEED;
+	if (d->sun.x < 0.4f) {
+		d->sun.y += 0.0005f;
+	}
+	else if (d->sun.x < 0.5f) {
+		d->sun.y += 0.00005f;
+	}
+	else if (d->sun.x < 0.6f) {
+		d->sun.y -= 0.00005f;
+	}
+	else {
+		d->sun.y -= 0.0005f;
+	}
+
+	if (frame % (DAY_FRAMES / 2) > OLD_FADE_FRAME) {
+		d->skyTop = fadeColor(d->skyTop, d->dayTime ? BLACK : DARKBLUE, 1.0f / 50.0f);
+		d->skyBottom = fadeColor(d->skyBottom, d->dayTime ? GREY : LIGHTBLUE, 1.0f / 50.0f);
+	}
+}
+
+/*
+	Seeking straight to a time of day shows what stepping there did: every
+	frame of a day matches the old frame-by-frame model, and scenes stepped at
+	60 Hz and DAYLIGHT_FAST_RATE show the same sun and sky at each sample.
+*/
+static bool checkDaylight(const Config *c)
+{
+	Daylight stepped;
+	int frame = 0;
+	stepOldDaylight(&stepped, frame);
+	for (; frame < DAY_FRAMES; stepOldDaylight(&stepped, ++frame)) {
+		Daylight sought = daylightAt((float)frame / DAY_FRAMES);
+		if (!sameDaylight(&stepped, &sought)) {
+			break;
+		}
+	}
+	if (frame < DAY_FRAMES) {
+		printf("FAIL daylight: seeking to frame %d of the day doesn't match stepping to it\n", frame);
+		return false;
+	}
+
+	Config slow = *c;
+	slow.particles = DAYLIGHT_PARTICLES;
+	slow.tickRate = REFERENCE_RATE;
+	Config fast = slow;
+	fast.tickRate = DAYLIGHT_FAST_RATE;
+	int fastSample = DAYLIGHT_SAMPLE * DAYLIGHT_FAST_RATE / REFERENCE_RATE;
+
+	startTestScene(&first, &slow);
+	startTestScene(&second, &fast);
+	stepTicks(&first, DAYLIGHT_SAMPLE / 2);
+	stepTicks(&second, fastSample / 2);
+
+	for (frame = DAYLIGHT_SAMPLE / 2; frame < DAY_FRAMES; frame += DAYLIGHT_SAMPLE) {
+		Daylight sought = daylightAt((float)frame / DAY_FRAMES);
+		Daylight slowShown = shownBy(&first);
+		Daylight fastShown = shownBy(&second);
+		if (!sameDaylight(&slowShown, &sought) || !sameDaylight(&fastShown, &sought)) {
+			break;
+		}
+		stepTicks(&first, DAYLIGHT_SAMPLE);
+		stepTicks(&second, fastSample);
+	}
+	endTestScene(&first);
+	endTestScene(&second);
+
+	if (sawEmptyScene || frame >= DAY_FRAMES) {
+		return report("daylight", 0, 0);
+	}
+	printf("FAIL daylight: a scene stepped to frame %d of the day doesn't match seeking to it\n", frame);
+	return false;
+}
+
+int runSelfTest(const Config *c)
+{
+	Config test = *c;
+	test.particles = TEST_PARTICLES;
+	test.capacity = 0;
+	test.seed = TEST_SEED;
+	test.prefill = true;
+
+	if (!initJobs(c->threads)) {
+		fprintf(stderr, "Couldn't start %d worker threads\n", c->threads);
+		return 1;
+	}
+
+	int failed = 0;
+	int run = 0;
+	failed += !checkThreads(&test);
+	run++;
+	failed += !checkReplay(&test);
+	run++;
+	failed += !checkCheckpoint(&test);
+	run++;
+	failed += !checkDaylight(&test);
+	run++;
+
+	shutdownJobs();
+	printf("%d of %d checks passed\n", run - failed, run);
+	return failed > 0;
+}
@@ -0,0 +1,23 @@
+/******************************************************************************
+ *
+ * Self-test
+ *
+ * Headless regression checks for the promises the simulation makes, run with
+ * --self-test. Each check runs small scenes two ways that have to agree and
+ * compares their state checksums, printing one PASS or FAIL line.
+ *
+ ******************************************************************************/
+
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include "config.h"
+
+/*
+	Run every check on scenes set up from c (with a fixed seed and particle
+	count). Starts and stops the job pool itself. Returns a process exit code:
+	0 if every check passed.
+*/
+int runSelfTest(const Config *c);
+
+#endif
@@ -0,0 +1,39 @@
+/******************************************************************************
+ *
+ * SIMD support
+ *
+ * Picks the widest instruction set the compiler was told it may use. Building
+ * with /arch:AVX2 (MSVC) or -mavx2 (GCC/Clang) selects the 8-wide paths; every
+ * x64 target has at least SSE2. Anything else falls back to scalar code.
+ *
+ ******************************************************************************/
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#if defined(__AVX2__)
+#define SIMD_AVX2
+#define SIMD_SSE2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit of a non-zero mask.
+static inline int lowestBit(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+#endif
@@ -0,0 +1,70 @@
+/******************************************************************************
+ *
+ * Snow cover
+ *
+ ******************************************************************************/
+
+#include "snowcover.h"
+
+#include <string.h>
+
+static void updateSurface(SnowCover *c, int column)
+{
+	bool lifted = column >= c->liftBegin && column < c->liftEnd;
+	c->surface[column] = c->base[column] + c->depth[column] + (lifted ? c->lift : 0.0f);
+}
+
+void clearSnowCover(SnowCover *c)
+{
+	memset(c->depth, 0, sizeof(c->depth));
+	for (int column = 0; column < SNOW_COLUMNS; column++) {
+		updateSurface(c, column);
+	}
+}
+
+void liftSnowCover(SnowCover *c, float lift)
+{
+	if (lift == c->lift) {
+		return;
+	}
+	c->lift = lift;
+	for (int column = c->liftBegin; column < c->liftEnd; column++) {
+		updateSurface(c, column);
+	}
+}
+
+// Height of a column's snow with the snowman at rest, so a jump doesn't shake it loose.
+static float restingHeight(const SnowCover *c, int column)
+{
+	return c->base[column] + c->depth[column];
+}
+
+void depositSnow(SnowCover *c, float x, float amount)
+{
+	if (!(x >= 0.0f && x < 1.0f)) {
+		return;
+	}
+	int column = snowColumn(x);
+
+	// Try the neighbour on the side of the column the flake is nearer first.
+	int toward = x * SNOW_COLUMNS - column < 0.5f ? -1 : 1;
+	for (int step = 0; step < SNOW_SLIDE_STEPS; step++) {
+		float height = restingHeight(c, column);
+		int next = -1;
+		for (int side = 0; side < 2 && next < 0; side++) {
+			int neighbour = column + (side == 0 ? toward : -toward);
+			if (neighbour >= 0 && neighbour < SNOW_COLUMNS && height - restingHeight(c, neighbour) > SNOW_SLIDE_SLOPE) {
+				next = neighbour;
+			}
+		}
+		if (next < 0) {
+			break;
+		}
+		toward = next - column;
+		column = next;
+	}
+
+	float depth = c->depth[column] + amount;
+	c->depth[column] = depth < SNOW_MAX_DEPTH ? depth : SNOW_MAX_DEPTH;
+	updateSurface(c, column);
+}
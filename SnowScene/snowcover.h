@@ -0,0 +1,70 @@
+/******************************************************************************
+ *
+ * Snow cover
+ *
+ * Snow that has landed, kept as a heightfield of SNOW_COLUMNS equal columns
+ * across the window. Each column has a base (the ground, or the top of the
+ * snowman where it stands above the ground) and a depth of snow on it; the
+ * surface array is the sum, as falling flakes see it, so a flake's landing
+ * test is a single lookup. Landing flakes add to the depth of their column,
+ * which updates that column alone, so the cost per tick follows the number of
+ * flakes landing and not the amount of snow lying.
+ *
+ ******************************************************************************/
+
+#ifndef SNOWCOVER_H
+#define SNOWCOVER_H
+
+#include <stdbool.h>
+
+#include "particles.h"
+
+// Depth a landed flake adds to its column, per pixel of flake size.
+#define SNOW_FLAKE_DEPTH 0.0001f
+
+// Columns stop filling at this depth.
+#define SNOW_MAX_DEPTH 0.03f
+
+// A flake landing more than this above a neighbouring column slides onto it,
+// up to SNOW_SLIDE_STEPS columns, so the snow settles into slopes of about 45
+// degrees instead of towers.
+#define SNOW_SLIDE_SLOPE (1.0f / SNOW_COLUMNS)
+#define SNOW_SLIDE_STEPS 32
+
+typedef struct {
+	float base[SNOW_COLUMNS];    // what the snow lies on, with the snowman at rest
+	float depth[SNOW_COLUMNS];   // snow lying in each column
+	float surface[SNOW_COLUMNS]; // where flakes land: base + depth, raised by lift on the snowman
+	int liftBegin, liftEnd;      // columns [liftBegin, liftEnd) rest on the snowman
+	float lift;                  // how far the snowman is raised
+} SnowCover;
+
+// The column x lies in, clamped to the window's columns (the first for NaN, as the SIMD paths do).
+static inline int snowColumn(float x)
+{
+	float column = x * SNOW_COLUMNS;
+	if (!(column >= 0.0f)) {
+		column = 0.0f;
+	}
+	if (column > SNOW_COLUMNS - 1) {
+		column = SNOW_COLUMNS - 1;
+	}
+	return (int)column;
+}
+
+/*
+	Remove all lying snow. The base and lift range must already be filled in.
+*/
+void clearSnowCover(SnowCover *c);
+
+// Raise the columns on the snowman, and the snow on them, by lift.
+void liftSnowCover(SnowCover *c, float lift);
+
+/*
+	Add amount of snow where a flake landed at x, sliding downhill first if the
+	column stands too far above a neighbour. Flakes landing outside the window
+	leave nothing.
+*/
+void depositSnow(SnowCover *c, float x, float amount);
+
+#endif
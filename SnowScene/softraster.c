@@ -0,0 +1,489 @@
+/******************************************************************************
+ *
+ * Software rasteriser
+ *
+ ******************************************************************************/
+
+#include "softraster.h"
+#include "geometry.h"
+#include "jobs.h"
+#include "platform.h"
+#include "simd.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A vertex in window pixels, with colour channels and alpha all on a 0-255 scale.
+typedef struct {
+	float x, y;
+	float c[4];
+} RasterVertex;
+
+typedef struct {
+	Framebuffer *fb;
+	const Scene *s;
+	const SceneView *view;
+	const Point *sunRing;
+	int sunSegments;
+	const Point *partRings[6];
+	int partSegments[6];
+	bool snow; // false if there was no memory to bin the flakes
+} RenderJob;
+
+bool initFramebuffer(Framebuffer *fb, int width, int height)
+{
+	memset(fb, 0, sizeof(*fb));
+	return resizeFramebuffer(fb, width, height);
+}
+
+void freeFramebuffer(Framebuffer *fb)
+{
+	alignedFree(fb->pixels);
+	free(fb->snowOrder);
+	free(fb->binStart);
+	memset(fb, 0, sizeof(*fb));
+}
+
+bool resizeFramebuffer(Framebuffer *fb, int width, int height)
+{
+	unsigned char *pixels = alignedAlloc((size_t)width * height * 4, 64);
+	if (pixels == NULL) {
+		return false;
+	}
+	alignedFree(fb->pixels);
+	fb->pixels = pixels;
+	fb->width = width;
+	fb->height = height;
+	return true;
+}
+
+/*
+	Round a colour channel the way both span paths do, so SIMD and scalar code
+	give identical pixels.
+*/
+static inline int toByte(float value)
+{
+	if (value <= 0.0f) {
+		return 0;
+	}
+	if (value >= 255.0f) {
+		return 255;
+	}
+	return (int)(value + 0.5f);
+}
+
+// s * a + d * (255 - a), divided by 255 with rounding.
+static inline int blendChannel(int s, int d, int a)
+{
+	int t = s * a + d * (255 - a) + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+/*
+	Shade n pixels starting at dst with a colour that starts at colour and
+	changes by step per pixel, blending with SRC_ALPHA / ONE_MINUS_SRC_ALPHA.
+	The framebuffer has no alpha channel of its own, so alpha is left at 255.
+*/
+static void shadeSpan(unsigned char *dst, int n, const float colour[4], const float step[4])
+{
+	int i = 0;
+
+#if defined(SIMD_SSE2)
+	__m128 base = _mm_loadu_ps(colour);
+	__m128 slope = _mm_loadu_ps(step);
+	__m128 lo = _mm_setzero_ps();
+	__m128 hi = _mm_set1_ps(255.0f);
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128i zero = _mm_setzero_si128();
+	__m128i full = _mm_set1_epi16(255);
+	__m128i round = _mm_set1_epi16(128);
+	__m128i opaqueAlpha = _mm_set1_epi32((int)0xFF000000u);
+
+	for (; i + 4 <= n; i += 4) {
+		// colour + step * i per pixel, exactly as the scalar loop below computes it.
+		__m128 p0 = _mm_add_ps(base, _mm_mul_ps(slope, _mm_set1_ps((float)i)));
+		__m128 p1 = _mm_add_ps(base, _mm_mul_ps(slope, _mm_set1_ps((float)(i + 1))));
+		__m128 p2 = _mm_add_ps(base, _mm_mul_ps(slope, _mm_set1_ps((float)(i + 2))));
+		__m128 p3 = _mm_add_ps(base, _mm_mul_ps(slope, _mm_set1_ps((float)(i + 3))));
+		__m128i s0 = _mm_cvttps_epi32(_mm_add_ps(_mm_min_ps(_mm_max_ps(p0, lo), hi), half));
+		__m128i s1 = _mm_cvttps_epi32(_mm_add_ps(_mm_min_ps(_mm_max_ps(p1, lo), hi), half));
+		__m128i s2 = _mm_cvttps_epi32(_mm_add_ps(_mm_min_ps(_mm_max_ps(p2, lo), hi), half));
+		__m128i s3 = _mm_cvttps_epi32(_mm_add_ps(_mm_min_ps(_mm_max_ps(p3, lo), hi), half));
+		__m128i srcLo = _mm_packs_epi32(s0, s1); // pixels 0-1 as 16-bit RGBA
+		__m128i srcHi = _mm_packs_epi32(s2, s3); // pixels 2-3
+
+		__m128i alphaLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(srcLo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		__m128i alphaHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(srcHi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+		__m128i target = _mm_loadu_si128((const __m128i *)(dst + 4 * i));
+		__m128i dstLo = _mm_unpacklo_epi8(target, zero);
+		__m128i dstHi = _mm_unpackhi_epi8(target, zero);
+
+		__m128i tLo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(srcLo, alphaLo),
+			_mm_mullo_epi16(dstLo, _mm_sub_epi16(full, alphaLo))), round);
+		__m128i tHi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(srcHi, alphaHi),
+			_mm_mullo_epi16(dstHi, _mm_sub_epi16(full, alphaHi))), round);
+		tLo = _mm_srli_epi16(_mm_add_epi16(tLo, _mm_srli_epi16(tLo, 8)), 8);
+		tHi = _mm_srli_epi16(_mm_add_epi16(tHi, _mm_srli_epi16(tHi, 8)), 8);
+
+		_mm_storeu_si128((__m128i *)(dst + 4 * i), _mm_or_si128(_mm_packus_epi16(tLo, tHi), opaqueAlpha));
+	}
+#endif
+
+	for (; i < n; i++) {
+		unsigned char *pixel = dst + 4 * i;
+		int c[4];
+		for (int k = 0; k < 4; k++) {
+			c[k] = toByte(colour[k] + step[k] * (float)i);
+		}
+		pixel[0] = (unsigned char)blendChannel(c[0], pixel[0], c[3]);
+		pixel[1] = (unsigned char)blendChannel(c[1], pixel[1], c[3]);
+		pixel[2] = (unsigned char)blendChannel(c[2], pixel[2], c[3]);
+		pixel[3] = 255;
+	}
+}
+
+/*
+	Fill the pixels whose centres lie inside the triangle, within rows
+	[rowBegin, rowEnd). Centres on a left or bottom edge are in, centres on a
+	right or top edge are out, so triangles sharing an edge never overlap.
+*/
+static void drawTriangle(Framebuffer *fb, int rowBegin, int rowEnd, RasterVertex v0, RasterVertex v1, RasterVertex v2)
+{
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+	if (area == 0.0f) {
+		return;
+	}
+
+	// Colour gradients across the screen, from the plane through the three vertices.
+	float dx[4];
+	float dy[4];
+	for (int k = 0; k < 4; k++) {
+		float d1 = v1.c[k] - v0.c[k];
+		float d2 = v2.c[k] - v0.c[k];
+		dx[k] = (d1 * (v2.y - v0.y) - d2 * (v1.y - v0.y)) / area;
+		dy[k] = (d2 * (v1.x - v0.x) - d1 * (v2.x - v0.x)) / area;
+	}
+	RasterVertex origin = v0;
+
+	// Sort by height: bottom (a), middle (b), top (c).
+	RasterVertex t;
+	if (v1.y < v0.y) { t = v0; v0 = v1; v1 = t; }
+	if (v2.y < v1.y) { t = v1; v1 = v2; v2 = t; }
+	if (v1.y < v0.y) { t = v0; v0 = v1; v1 = t; }
+
+	int first = (int)ceilf(v0.y - 0.5f);
+	int last = (int)ceilf(v2.y - 0.5f);
+	if (first < rowBegin) {
+		first = rowBegin;
+	}
+	if (last > rowEnd) {
+		last = rowEnd;
+	}
+
+	for (int row = first; row < last; row++) {
+		float yc = row + 0.5f;
+
+		// The long edge spans every row; the short edge depends on which half we're in.
+		float xLong = v0.x + (yc - v0.y) * (v2.x - v0.x) / (v2.y - v0.y);
+		float xShort;
+		if (yc < v1.y) {
+			xShort = v0.x + (yc - v0.y) * (v1.x - v0.x) / (v1.y - v0.y);
+		}
+		else {
+			xShort = v1.x + (yc - v1.y) * (v2.x - v1.x) / (v2.y - v1.y);
+		}
+
+		float left = xLong < xShort ? xLong : xShort;
+		float right = xLong < xShort ? xShort : xLong;
+		int begin = (int)ceilf(left - 0.5f);
+		int end = (int)ceilf(right - 0.5f);
+		if (begin < 0) {
+			begin = 0;
+		}
+		if (end > fb->width) {
+			end = fb->width;
+		}
+		if (begin >= end) {
+			continue;
+		}
+
+		float colour[4];
+		for (int k = 0; k < 4; k++) {
+			colour[k] = origin.c[k] + dx[k] * (begin + 0.5f - origin.x) + dy[k] * (yc - origin.y);
+		}
+		shadeSpan(fb->pixels + ((size_t)row * fb->width + begin) * 4, end - begin, colour, dx);
+	}
+}
+
+/*
+	Fill an axis-aligned rectangle given in window pixels, within rows
+	[rowBegin, rowEnd), covering the same pixel centres drawTriangle() would
+	for its two halves.
+*/
+static void drawRect(Framebuffer *fb, int rowBegin, int rowEnd, float left, float bottom, float right, float top, const float colour[4])
+{
+	static const float noStep[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+	int first = (int)ceilf(bottom - 0.5f);
+	int last = (int)ceilf(top - 0.5f);
+	int begin = (int)ceilf(left - 0.5f);
+	int end = (int)ceilf(right - 0.5f);
+	if (first < rowBegin) {
+		first = rowBegin;
+	}
+	if (last > rowEnd) {
+		last = rowEnd;
+	}
+	if (begin < 0) {
+		begin = 0;
+	}
+	if (end > fb->width) {
+		end = fb->width;
+	}
+	for (int row = first; row < last && begin < end; row++) {
+		shadeSpan(fb->pixels + ((size_t)row * fb->width + begin) * 4, end - begin, colour, noStep);
+	}
+}
+
+static RasterVertex rasterVertex(const Framebuffer *fb, float x, float y, Colour colour, float alpha)
+{
+	RasterVertex v = { x * fb->width, y * fb->height, { colour.r, colour.g, colour.b, alpha * 255.0f } };
+	return v;
+}
+
+// The same triangle fan drawCircle() submits.
+static void drawFan(Framebuffer *fb, int rowBegin, int rowEnd, float cx, float cy, float r,
+	const Point *ring, int segments, Colour inner, Colour outer)
+{
+	// Nothing to do for bands the circle doesn't reach.
+	float top = (cy + r) * fb->height + 1.0f;
+	float bottom = (cy - r) * fb->height - 1.0f;
+	if (ring == NULL || top < rowBegin || bottom > rowEnd) {
+		return;
+	}
+
+	RasterVertex centre = rasterVertex(fb, cx, cy, inner, 1.0f);
+	RasterVertex previous = rasterVertex(fb, cx + r * ring[0].x, cy + r * ring[0].y, outer, 1.0f);
+	for (int i = 1; i <= segments; i++) {
+		RasterVertex next = rasterVertex(fb, cx + r * ring[i].x, cy + r * ring[i].y, outer, 1.0f);
+		drawTriangle(fb, rowBegin, rowEnd, centre, previous, next);
+		previous = next;
+	}
+}
+
+/*
+	First pixel covered by a point of the given size at window coordinate w.
+	GL centres odd sizes on the pixel containing w and even sizes on the pixel
+	corner nearest to it. A w no run makes (far out, or NaN, from a checkpoint)
+	is moved to SPLAT_REACH left of the window, which is off screen too, so
+	the int maths can't overflow.
+*/
+#define SPLAT_REACH 16777216.0f
+
+static inline int splatStart(float w, int size)
+{
+	if (!(w > -SPLAT_REACH && w < SPLAT_REACH)) {
+		w = -SPLAT_REACH;
+	}
+	if (size & 1) {
+		return (int)floorf(w) - (size - 1) / 2;
+	}
+	return (int)floorf(w + 0.5f) - size / 2;
+}
+
+/*
+	Bin the flakes by (band, size) with a counting sort, in particle order within
+	each bin, so every band can draw its flakes in the same order drawSnow()
+	submits them. A flake straddling two bands goes in both bins.
+*/
+static bool binSnow(Framebuffer *fb, const ParticleStore *snow, float rise, int bands)
+{
+	int bins = bands * SNOW_SIZES;
+	if (bins + 1 > fb->binCapacity) {
+		int *grown = realloc(fb->binStart, (size_t)(bins + 1) * sizeof(int));
+		if (grown == NULL) {
+			return false;
+		}
+		fb->binStart = grown;
+		fb->binCapacity = bins + 1;
+	}
+	if (2 * snow->count > fb->snowOrderCapacity) {
+		int *grown = realloc(fb->snowOrder, (size_t)2 * snow->capacity * sizeof(int));
+		if (grown == NULL) {
+			return false;
+		}
+		fb->snowOrder = grown;
+		fb->snowOrderCapacity = 2 * snow->capacity;
+	}
+
+	int *start = fb->binStart;
+	memset(start, 0, (size_t)(bins + 1) * sizeof(int));
+
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < snow->count; i++) {
+			int size = flakeSize(snow->size[i]);
+			int row = splatStart((snow->y[i] + snow->speed[i] * rise) * fb->height, size);
+			if (row + size <= 0 || row >= fb->height) {
+				continue;
+			}
+
+			int firstBand = row < 0 ? 0 : row / SOFT_BAND_ROWS;
+			int lastBand = (row + size - 1) / SOFT_BAND_ROWS;
+			if (lastBand >= bands) {
+				lastBand = bands - 1;
+			}
+			for (int band = firstBand; band <= lastBand; band++) {
+				int bin = band * SNOW_SIZES + size - SNOW_MIN_SIZE;
+				if (pass == 0) {
+					start[bin + 1]++;
+				}
+				else {
+					fb->snowOrder[start[bin]++] = i;
+				}
+			}
+		}
+
+		if (pass == 0) {
+			for (int bin = 0; bin < bins; bin++) {
+				start[bin + 1] += start[bin];
+			}
+		}
+	}
+
+	// The fill pass advanced every start to the next bin's start: shift back.
+	memmove(start + 1, start, (size_t)bins * sizeof(int));
+	start[0] = 0;
+	return true;
+}
+
+static void drawSnowBand(Framebuffer *fb, const ParticleStore *snow, float rise, int band, int rowBegin, int rowEnd)
+{
+	static const float noStep[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+	for (int bucket = 0; bucket < SNOW_SIZES; bucket++) {
+		int bin = band * SNOW_SIZES + bucket;
+		int size = bucket + SNOW_MIN_SIZE;
+
+		for (int k = fb->binStart[bin]; k < fb->binStart[bin + 1]; k++) {
+			int i = fb->snowOrder[k];
+
+			// Match the colour drawSnow() puts in its vertex array.
+			float colour[4] = { 255.0f, 255.0f, 255.0f, (float)flakeAlpha(snow->transparency[i]) };
+
+			int column = splatStart(snow->x[i] * fb->width, size);
+			int row = splatStart((snow->y[i] + snow->speed[i] * rise) * fb->height, size);
+			int columnEnd = column + size;
+			int rowLast = row + size;
+			if (column < 0) {
+				column = 0;
+			}
+			if (columnEnd > fb->width) {
+				columnEnd = fb->width;
+			}
+			if (row < rowBegin) {
+				row = rowBegin;
+			}
+			if (rowLast > rowEnd) {
+				rowLast = rowEnd;
+			}
+			for (; row < rowLast && column < columnEnd; row++) {
+				shadeSpan(fb->pixels + ((size_t)row * fb->width + column) * 4, columnEnd - column, colour, noStep);
+			}
+		}
+	}
+}
+
+static void renderBand(void *context, int rowBegin, int rowEnd)
+{
+	RenderJob *job = context;
+	Framebuffer *fb = job->fb;
+	const Scene *s = job->s;
+	const SceneView *view = job->view;
+
+	// glClear() to black.
+	memset(fb->pixels + (size_t)rowBegin * fb->width * 4, 0, (size_t)(rowEnd - rowBegin) * fb->width * 4);
+	for (int row = rowBegin; row < rowEnd; row++) {
+		unsigned char *pixel = fb->pixels + (size_t)row * fb->width * 4;
+		for (int i = 0; i < fb->width; i++) {
+			pixel[4 * i + 3] = 255;
+		}
+	}
+
+	// Sky
+	RasterVertex sky[4] = {
+		rasterVertex(fb, 0.0f, 0.0f, view->skyBottom, 1.0f),
+		rasterVertex(fb, 1.0f, 0.0f, view->skyBottom, 1.0f),
+		rasterVertex(fb, 1.0f, 1.0f, view->skyTop, 0.9f),
+		rasterVertex(fb, 0.0f, 1.0f, view->skyTop, 0.9f),
+	};
+	drawTriangle(fb, rowBegin, rowEnd, sky[0], sky[1], sky[2]);
+	drawTriangle(fb, rowBegin, rowEnd, sky[0], sky[2], sky[3]);
+
+	// Ground, as the same fan GL_POLYGON is drawn with.
+	Colour snowWhite = { 255, 250, 253 };
+	Colour snowShade = { 167, 191, 219 };
+	RasterVertex ground[6] = {
+		rasterVertex(fb, 1.0f, 0.0f, snowWhite, 1.0f),
+		rasterVertex(fb, 0.0f, 0.0f, snowWhite, 1.0f),
+	};
+	for (int i = 0; i < 4; i++) {
+		ground[i + 2] = rasterVertex(fb, s->groundVertices[i].x, s->groundVertices[i].y, snowShade, 1.0f);
+	}
+	for (int i = 1; i < 5; i++) {
+		drawTriangle(fb, rowBegin, rowEnd, ground[0], ground[i], ground[i + 1]);
+	}
+
+	drawFan(fb, rowBegin, rowEnd, view->sun.x, view->sun.y, 0.1f, job->sunRing, job->sunSegments, view->sun.colour, view->sun.colour);
+
+	for (int i = 0; i < 6; i++) {
+		const Snowman *part = &s->snowman[i];
+		drawFan(fb, rowBegin, rowEnd, part->cx, part->cy + view->snowmanOffset, part->r,
+			job->partRings[i], job->partSegments[i], part->inner, part->outer);
+	}
+
+	// The quads drawSnowCover() submits.
+	const SnowCover *cover = &s->cover;
+	float coverColour[4] = { WHITE.r, WHITE.g, WHITE.b, 255.0f };
+	for (int column = 0; column < SNOW_COLUMNS; column++) {
+		if (cover->depth[column] <= 0.0f) {
+			continue;
+		}
+		bool lifted = column >= cover->liftBegin && column < cover->liftEnd;
+		float bottom = cover->base[column] + (lifted ? view->snowmanOffset : 0.0f);
+		drawRect(fb, rowBegin, rowEnd, (float)column / SNOW_COLUMNS * fb->width, bottom * fb->height,
+			(float)(column + 1) / SNOW_COLUMNS * fb->width, (bottom + cover->depth[column]) * fb->height, coverColour);
+	}
+
+	if (job->snow) {
+		drawSnowBand(fb, &s->snow, view->snowRise, rowBegin / SOFT_BAND_ROWS, rowBegin, rowEnd);
+	}
+}
+
+void renderScene(Framebuffer *fb, const Scene *s, const SceneView *view)
+{
+	RenderJob job;
+	job.fb = fb;
+	job.s = s;
+	job.view = view;
+
+	// Resolve circle detail and rings up front: the ring cache isn't thread-safe.
+	int longSide = fb->width > fb->height ? fb->width : fb->height;
+	job.sunSegments = circleSegments(0.1f * longSide);
+	job.sunRing = unitCircle(&job.sunSegments);
+	for (int i = 0; i < 6; i++) {
+		int segments = s->snowman[i].segments;
+		if (segments == CIRCLE_AUTO_SEGMENTS) {
+			segments = circleSegments(s->snowman[i].r * longSide);
+		}
+		job.partRings[i] = unitCircle(&segments);
+		job.partSegments[i] = segments;
+	}
+
+	int bands = (fb->height + SOFT_BAND_ROWS - 1) / SOFT_BAND_ROWS;
+	// Out of memory: draw the frame without snow rather than not at all.
+	job.snow = binSnow(fb, &s->snow, view->snowRise, bands);
+
+	parallelFor(fb->height, SOFT_BAND_ROWS, renderBand, &job);
+}
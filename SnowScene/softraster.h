@@ -0,0 +1,49 @@
+/******************************************************************************
+ *
+ * Software rasteriser
+ *
+ * Draws the scene into an RGBA framebuffer in memory, with no GL context, for
+ * machines without a GPU. It follows the rules OpenGL uses for what display()
+ * submits - pixel-centre sampling for triangles, Gouraud-shaded colour, square
+ * point splats and SRC_ALPHA / ONE_MINUS_SRC_ALPHA blending - so the output
+ * matches the GL path to within rounding. The diagnostics text is not drawn.
+ *
+ * The frame is split into horizontal bands rendered in parallel on the job
+ * threads; every band draws in submission order, so the result doesn't depend
+ * on the thread count.
+ *
+ ******************************************************************************/
+
+#ifndef SOFTRASTER_H
+#define SOFTRASTER_H
+
+#include <stdbool.h>
+
+#include "scene.h"
+
+// Rows per band handed to a job thread.
+#define SOFT_BAND_ROWS 64
+
+typedef struct {
+	int width;
+	int height;
+	unsigned char *pixels; // RGBA, rows from bottom to top like glReadPixels()
+
+	// Scratch for sorting flakes into (band, size) bins.
+	int *snowOrder;
+	int snowOrderCapacity;
+	int *binStart;
+	int binCapacity;
+} Framebuffer;
+
+// Returns false if out of memory.
+bool initFramebuffer(Framebuffer *fb, int width, int height);
+void freeFramebuffer(Framebuffer *fb);
+
+// Reallocate for a new size. Returns false if out of memory.
+bool resizeFramebuffer(Framebuffer *fb, int width, int height);
+
+// Draw everything display() draws for this view of s, apart from the diagnostics text.
+void renderScene(Framebuffer *fb, const Scene *s, const SceneView *view);
+
+#endif
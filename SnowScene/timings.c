@@ -0,0 +1,182 @@
+/******************************************************************************
+ *
+ * Frame timings
+ *
+ ******************************************************************************/
+
+#include "timings.h"
+#include "atomics.h"
+#include "platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char *const phaseNames[PHASE_COUNT] = {
+	"think", "background", "sun", "snowman", "snow", "software", "overlay", "swap", "frame",
+};
+
+static FrameTiming ring[TIMING_FRAMES];
+static volatile int64_t published; // frames published so far
+
+// Only touched by the frame loop's thread.
+static FrameTiming gathering;
+static uint64_t lastFrameEnd;
+
+// Scratch for summariseTimings() and writeTimings().
+static FrameTiming snapshot[TIMING_FRAMES];
+static uint32_t sorted[TIMING_FRAMES];
+
+uint64_t recordPhase(Phase phase, uint64_t startNs)
+{
+	uint64_t now = timeNowNs();
+	uint64_t total = gathering.ns[phase] + (now - startNs);
+	gathering.ns[phase] = total > UINT32_MAX ? UINT32_MAX : (uint32_t)total;
+	return now;
+}
+
+const FrameTiming *finishFrameTiming(void)
+{
+	uint64_t now = timeNowNs();
+	if (lastFrameEnd != 0) {
+		uint64_t frame = now - lastFrameEnd;
+		gathering.ns[PHASE_FRAME] = frame > UINT32_MAX ? UINT32_MAX : (uint32_t)frame;
+	}
+	lastFrameEnd = now;
+
+	int64_t count = published;
+	FrameTiming *slot = &ring[count & (TIMING_FRAMES - 1)];
+	*slot = gathering;
+	atomicStore64(&published, count + 1);
+	memset(&gathering, 0, sizeof(gathering));
+	return slot;
+}
+
+int copyFrameTimings(FrameTiming *out, int max, uint64_t *first)
+{
+	int64_t end = atomicLoad64(&published);
+	int64_t begin = end - (max < TIMING_FRAMES ? max : TIMING_FRAMES);
+	if (begin < 0) {
+		begin = 0;
+	}
+	for (int64_t i = begin; i < end; i++) {
+		out[i - begin] = ring[i & (TIMING_FRAMES - 1)];
+	}
+
+	// The writer may have been filling slots as we read them: the frame it is
+	// working on now reuses the slot of frame (now - TIMING_FRAMES), so only
+	// frames after that are certainly intact.
+	int64_t now = atomicLoad64(&published);
+	int64_t safe = now - TIMING_FRAMES + 1;
+	int skip = safe > begin ? (int)(safe - begin) : 0;
+	if (skip >= end - begin) {
+		return 0;
+	}
+	if (skip > 0) {
+		memmove(out, out + skip, (size_t)(end - begin - skip) * sizeof(FrameTiming));
+	}
+	if (first != NULL) {
+		*first = (uint64_t)(begin + skip);
+	}
+	return (int)(end - begin - skip);
+}
+
+static int compareNs(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// The smallest sample with at least percent of the sorted samples at or below it.
+static uint32_t percentile(const uint32_t *values, int n, int percent)
+{
+	int rank = (n * percent + 99) / 100;
+	return values[rank > 0 ? rank - 1 : 0];
+}
+
+static void summarise(const FrameTiming *frames, int n, PhaseSummary summary[PHASE_COUNT])
+{
+	memset(summary, 0, PHASE_COUNT * sizeof(PhaseSummary));
+	if (n == 0) {
+		return;
+	}
+
+	for (int phase = 0; phase < PHASE_COUNT; phase++) {
+		for (int i = 0; i < n; i++) {
+			sorted[i] = frames[i].ns[phase];
+		}
+		qsort(sorted, (size_t)n, sizeof(uint32_t), compareNs);
+
+		summary[phase].p50 = percentile(sorted, n, 50);
+		summary[phase].p95 = percentile(sorted, n, 95);
+		summary[phase].p99 = percentile(sorted, n, 99);
+		summary[phase].worst = sorted[n - 1];
+	}
+}
+
+void summariseTimings(PhaseSummary summary[PHASE_COUNT])
+{
+	int n = copyFrameTimings(snapshot, TIMING_FRAMES, NULL);
+	summarise(snapshot, n, summary);
+}
+
+static bool endsWithJson(const char *path)
+{
+	size_t length = strlen(path);
+	return length >= 5 && strcmp(path + length - 5, ".json") == 0;
+}
+
+bool writeTimings(const char *path)
+{
+	uint64_t first = 0;
+	int n = copyFrameTimings(snapshot, TIMING_FRAMES, &first);
+	PhaseSummary summary[PHASE_COUNT];
+	summarise(snapshot, n, summary);
+
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Can't create \"%s\"\n", path);
+		return false;
+	}
+
+	// Everything is written in microseconds.
+	if (endsWithJson(path)) {
+		fprintf(file, "{\n\t\"unit\": \"us\",\n\t\"summary\": {\n");
+		for (int phase = 0; phase < PHASE_COUNT; phase++) {
+			fprintf(file, "\t\t\"%s\": { \"p50\": %.1f, \"p95\": %.1f, \"p99\": %.1f, \"worst\": %.1f }%s\n",
+				phaseNames[phase], summary[phase].p50 / 1e3, summary[phase].p95 / 1e3,
+				summary[phase].p99 / 1e3, summary[phase].worst / 1e3, phase + 1 < PHASE_COUNT ? "," : "");
+		}
+		fprintf(file, "\t},\n\t\"frames\": [\n");
+		for (int i = 0; i < n; i++) {
+			fprintf(file, "\t\t{ \"index\": %llu", (unsigned long long)(first + i));
+			for (int phase = 0; phase < PHASE_COUNT; phase++) {
+				fprintf(file, ", \"%s\": %.1f", phaseNames[phase], snapshot[i].ns[phase] / 1e3);
+			}
+			fprintf(file, " }%s\n", i + 1 < n ? "," : "");
+		}
+		fprintf(file, "\t]\n}\n");
+	}
+	else {
+		fprintf(file, "index");
+		for (int phase = 0; phase < PHASE_COUNT; phase++) {
+			fprintf(file, ",%s_us", phaseNames[phase]);
+		}
+		fprintf(file, "\n");
+		for (int i = 0; i < n; i++) {
+			fprintf(file, "%llu", (unsigned long long)(first + i));
+			for (int phase = 0; phase < PHASE_COUNT; phase++) {
+				fprintf(file, ",%.1f", snapshot[i].ns[phase] / 1e3);
+			}
+			fprintf(file, "\n");
+		}
+	}
+
+	bool ok = !ferror(file);
+	ok = fclose(file) == 0 && ok;
+	if (!ok) {
+		fprintf(stderr, "Couldn't write \"%s\"\n", path);
+	}
+	return ok;
+}
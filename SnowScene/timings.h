@@ -0,0 +1,80 @@
+/******************************************************************************
+ *
+ * Frame timings
+ *
+ * Hot-path timers for each phase of a frame. The thread running the frame loop
+ * fills in one FrameTiming at a time and publishes it to a ring holding the
+ * last TIMING_FRAMES frames. Publishing is a single atomic store and readers
+ * never block the writer: they copy the ring and then drop any frame the
+ * writer may have overwritten meanwhile.
+ *
+ * GL phases measure the CPU time spent submitting work. The GPU catches up
+ * wherever the driver makes us wait, usually in the buffer swap.
+ *
+ ******************************************************************************/
+
+#ifndef TIMINGS_H
+#define TIMINGS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+	PHASE_THINK,
+	PHASE_BACKGROUND,
+	PHASE_SUN,
+	PHASE_SNOWMAN,
+	PHASE_SNOW,
+	PHASE_SOFTWARE, // the whole scene, when drawn by the software rasteriser
+	PHASE_OVERLAY,
+	PHASE_SWAP,
+	PHASE_FRAME,    // from the end of one frame to the end of the next
+	PHASE_COUNT
+} Phase;
+
+// Frames kept for percentiles and the exit dump (a power of two).
+#define TIMING_FRAMES 1024
+
+typedef struct {
+	uint32_t ns[PHASE_COUNT];
+} FrameTiming;
+
+typedef struct {
+	uint32_t p50, p95, p99, worst; // ns
+} PhaseSummary;
+
+// Short lower-case names, as used in the dumps.
+extern const char *const phaseNames[PHASE_COUNT];
+
+/*
+	Add the time since startNs to phase in the frame being gathered and return
+	the current time, so consecutive phases can be timed with one clock read
+	each: t = recordPhase(PHASE_SUN, t).
+*/
+uint64_t recordPhase(Phase phase, uint64_t startNs);
+
+/*
+	Publish the frame being gathered, with its PHASE_FRAME time, and start the
+	next. Returns the frame just published, which stays valid until it is
+	overwritten TIMING_FRAMES frames later.
+*/
+const FrameTiming *finishFrameTiming(void);
+
+/*
+	Copy up to max of the most recent frames to out, oldest first. Safe from any
+	thread. Returns the number copied and, if first isn't NULL, stores the frame
+	number of out[0].
+*/
+int copyFrameTimings(FrameTiming *out, int max, uint64_t *first);
+
+// Percentiles and worst case of each phase over the frames in the ring.
+void summariseTimings(PhaseSummary summary[PHASE_COUNT]);
+
+/*
+	Write the frames in the ring to path: as JSON, with the summary as well, if
+	it ends in ".json", and as CSV otherwise. Returns false (after printing why)
+	on failure.
+*/
+bool writeTimings(const char *path);
+
+#endif
@@ -0,0 +1,128 @@
+/******************************************************************************
+ *
+ * Trace zones
+ *
+ ******************************************************************************/
+
+#include "trace.h"
+#include "atomics.h"
+#include "platform.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	const char *name;
+	uint64_t start;
+	uint64_t end;
+} TraceEvent;
+
+typedef struct {
+	TraceEvent events[TRACE_EVENTS];
+	uint64_t count; // zones recorded so far; only the owning thread writes it
+	char name[32];
+	int id;
+} TraceBuffer;
+
+bool traceEnabled = false;
+
+static uint64_t origin;
+static TraceBuffer *buffers[TRACE_MAX_THREADS];
+static volatile int32_t bufferCount;
+
+static THREAD_LOCAL TraceBuffer *threadBuffer;
+static THREAD_LOCAL bool threadDropped;
+
+void startTrace(void)
+{
+	origin = timeNowNs();
+	traceEnabled = true;
+}
+
+// The calling thread's buffer, created on its first zone. NULL if there is no room.
+static TraceBuffer *ownBuffer(void)
+{
+	if (threadBuffer != NULL || threadDropped) {
+		return threadBuffer;
+	}
+
+	int32_t slot = atomicAdd32(&bufferCount, 1);
+	TraceBuffer *buffer = slot < TRACE_MAX_THREADS ? calloc(1, sizeof(TraceBuffer)) : NULL;
+	if (buffer == NULL) {
+		threadDropped = true;
+		return NULL;
+	}
+	buffer->id = slot + 1;
+	snprintf(buffer->name, sizeof(buffer->name), "thread %d", slot + 1);
+	buffers[slot] = buffer;
+	threadBuffer = buffer;
+	return buffer;
+}
+
+void traceThreadName(const char *format, int number)
+{
+	if (!traceEnabled) {
+		return;
+	}
+	TraceBuffer *buffer = ownBuffer();
+	if (buffer != NULL) {
+		snprintf(buffer->name, sizeof(buffer->name), format, number);
+	}
+}
+
+void traceRecord(const char *name, uint64_t start, uint64_t end)
+{
+	TraceBuffer *buffer = ownBuffer();
+	if (buffer == NULL) {
+		return;
+	}
+	TraceEvent *event = &buffer->events[buffer->count & (TRACE_EVENTS - 1)];
+	event->name = name;
+	event->start = start;
+	event->end = end;
+	buffer->count++;
+}
+
+bool writeTrace(const char *path)
+{
+	FILE *file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Can't create \"%s\"\n", path);
+		return false;
+	}
+
+	// Times are in microseconds from startTrace().
+	int threads = atomicLoad32(&bufferCount);
+	threads = threads < TRACE_MAX_THREADS ? threads : TRACE_MAX_THREADS;
+	bool first = true;
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (int t = 0; t < threads; t++) {
+		const TraceBuffer *buffer = buffers[t];
+		if (buffer == NULL) {
+			continue;
+		}
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			first ? "" : ",\n", buffer->id, buffer->name);
+		first = false;
+
+		uint64_t end = buffer->count;
+		uint64_t begin = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+		for (uint64_t i = begin; i < end; i++) {
+			const TraceEvent *event = &buffer->events[i & (TRACE_EVENTS - 1)];
+			if (event->start < origin) {
+				continue;
+			}
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				event->name, buffer->id, (event->start - origin) / 1e3, (event->end - event->start) / 1e3);
+		}
+	}
+	fprintf(file, "\n]}\n");
+
+	bool ok = !ferror(file);
+	ok = fclose(file) == 0 && ok;
+	if (!ok) {
+		fprintf(stderr, "Couldn't write \"%s\"\n", path);
+	}
+	return ok;
+}
@@ -0,0 +1,79 @@
+/******************************************************************************
+ *
+ * Trace zones
+ *
+ * Timeline tracing for finding out where a particular frame went, where the
+ * frame timings only give totals. A zone records its name, start and end into
+ * a buffer belonging to the thread it ran on, so threads never contend. Each
+ * buffer is a ring keeping the thread's latest TRACE_EVENTS zones. On exit
+ * writeTrace() turns them into Chrome Trace Event JSON, which Perfetto
+ * (ui.perfetto.dev) and chrome://tracing open.
+ *
+ * Tracing is off until startTrace(); until then a zone costs one test of a
+ * flag. Building with NO_TRACE defined removes the zones altogether.
+ *
+ ******************************************************************************/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "platform.h"
+
+// Zones kept per thread (a power of two); older ones are overwritten.
+#define TRACE_EVENTS 65536
+
+// Threads that can record zones; zones from any beyond these are dropped.
+#define TRACE_MAX_THREADS 80
+
+extern bool traceEnabled;
+
+// Start recording. Call before starting any thread that records zones.
+void startTrace(void);
+
+/*
+	Name the calling thread in the trace, e.g. "worker 3". Does nothing while
+	tracing is off.
+*/
+void traceThreadName(const char *format, int number);
+
+// Record a zone that ran from start to end (timeNowNs() times).
+void traceRecord(const char *name, uint64_t start, uint64_t end);
+
+static inline uint64_t traceBegin(void)
+{
+	return traceEnabled ? timeNowNs() : 0;
+}
+
+// name must be a string literal (or otherwise live until writeTrace()).
+static inline void traceEnd(const char *name, uint64_t start)
+{
+	if (start != 0) {
+		traceRecord(name, start, timeNowNs());
+	}
+}
+
+/*
+	Write every thread's zones to path as Chrome Trace Event JSON. Call once the
+	threads recording zones have stopped or gone idle. Returns false (after
+	printing why) on failure.
+*/
+bool writeTrace(const char *path);
+
+/*
+	TRACE_BEGIN(zone) ... TRACE_END(zone, "name") times the code in between;
+	TRACE_ZONE("name", statement) times one statement.
+*/
+#ifdef NO_TRACE
+#define TRACE_BEGIN(zone)
+#define TRACE_END(zone, name)
+#define TRACE_ZONE(name, statement) do { statement; } while (0)
+#else
+#define TRACE_BEGIN(zone) uint64_t zone = traceBegin()
+#define TRACE_END(zone, name) traceEnd(name, zone)
+#define TRACE_ZONE(name, statement) do { uint64_t traceStart = traceBegin(); statement; traceEnd(name, traceStart); } while (0)
+#endif
+
+#endif
@@ -0,0 +1,212 @@
+/******************************************************************************
+ *
+ * Wind
+ *
+ ******************************************************************************/
+
+#include "wind.h"
+#include "rng.h"
+
+#include <math.h>
+#include <string.h>
+
+// Noise lattice points per row and per layer in time.
+#define NOISE_ROW (WIND_NOISE_CELLS + 3)
+#define NOISE_LAYER WIND_NOISE_POINTS
+
+// Stream function samples per row: every node and one beyond each side.
+#define PSI_ROW (WIND_NODES + 2)
+
+static float lattice(uint32_t key, int x, int y, int t)
+{
+	uint32_t index = (uint32_t)t * NOISE_LAYER + (uint32_t)((y + 1) * NOISE_ROW + x + 1);
+	return (rngAt(key, index) >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+static float smooth(float t)
+{
+	return t * t * (3.0f - 2.0f * t);
+}
+
+static float mix(float from, float to, float t)
+{
+	return from + (to - from) * t;
+}
+
+// Value noise in [-1, 1] over (x, y) in the window and t in lattice steps.
+static float noise(uint32_t key, float x, float y, float t)
+{
+	float fx = x * WIND_NOISE_CELLS;
+	float fy = y * WIND_NOISE_CELLS;
+	int ix = (int)floorf(fx);
+	int iy = (int)floorf(fy);
+	int it = (int)floorf(t);
+	float sx = smooth(fx - ix);
+	float sy = smooth(fy - iy);
+	float st = smooth(t - it);
+
+	float layer[2];
+	for (int k = 0; k < 2; k++) {
+		float bottom = mix(lattice(key, ix, iy, it + k), lattice(key, ix + 1, iy, it + k), sx);
+		float top = mix(lattice(key, ix, iy + 1, it + k), lattice(key, ix + 1, iy + 1, it + k), sx);
+		layer[k] = mix(bottom, top, sy);
+	}
+	return mix(layer[0], layer[1], st);
+}
+
+/*
+	The lattice at t (in lattice steps), already blended between its two
+	layers in time, so noise over the window at t is a bilinear mix of it.
+*/
+static void latticeAt(uint32_t key, float t, float *layer)
+{
+	int it = (int)floorf(t);
+	float st = smooth(t - it);
+	for (int y = -1; y < NOISE_ROW - 1; y++) {
+		for (int x = -1; x < NOISE_ROW - 1; x++) {
+			layer[(y + 1) * NOISE_ROW + x + 1] = mix(lattice(key, x, y, it), lattice(key, x, y, it + 1), st);
+		}
+	}
+}
+
+/*
+	Where node n of a row or column (from -1 to WIND_NODES) falls in the noise
+	lattice: the lattice point before it, offset into a layer row, and the
+	smoothed weight of the one after. The same along both axes.
+*/
+static void nodeLattice(int *cell, float *weight)
+{
+	for (int n = -1; n <= WIND_NODES; n++) {
+		float f = n * (1.0f / WIND_CELLS) * WIND_NOISE_CELLS;
+		int i = (int)floorf(f);
+		cell[n + 1] = i + 1;
+		weight[n + 1] = smooth(f - i);
+	}
+}
+
+/*
+	The stream function (value noise from a layer made by latticeAt()) at the
+	nodes of rows [begin, end), from one node left of the window to one right
+	of it, PSI_ROW to a row.
+*/
+static void streamRows(const float *layer, int begin, int end, float *psi)
+{
+	int cell[PSI_ROW];
+	float weight[PSI_ROW];
+	nodeLattice(cell, weight);
+
+	for (int row = begin; row < end; row++) {
+		const float *below = layer + cell[row + 1] * NOISE_ROW;
+		const float *above = below + NOISE_ROW;
+		float sy = weight[row + 1];
+		for (int column = 0; column < PSI_ROW; column++) {
+			int i = cell[column];
+			float sx = weight[column];
+			psi[(row - begin) * PSI_ROW + column] = mix(mix(below[i], below[i + 1], sx), mix(above[i], above[i + 1], sx), sy);
+		}
+	}
+}
+
+/*
+	Build rows [begin, end) of the back field for buildTime: the front field
+	advected by itself over one field's lifetime, moved renew of the way
+	towards the curl of the noise plus the breeze. The cells below the rows
+	are filled in too once both their edges are built.
+
+	The noise is the stream function: it is sampled once per node, one node
+	further out each way than the rows built, and its curl taken from the
+	nodes either side.
+*/
+static void buildRows(Wind *w, int begin, int end, float scale, float renew)
+{
+	const float *u = w->u[w->front];
+	const float *v = w->v[w->front];
+	const float *cells = w->cells[w->front];
+	float *nextU = w->u[!w->front];
+	float *nextV = w->v[!w->front];
+
+	float frames = WIND_TICKS_PER_FIELD * scale;
+	float h = 1.0f / WIND_CELLS;
+	float amplitude = WIND_TURBULENCE / WIND_NOISE_CELLS;
+	float breeze = w->breeze;
+
+	float psi[(WIND_NODES + 2) * PSI_ROW];
+	streamRows(w->layer, begin - 1, end + 1, psi);
+
+	for (int row = begin; row < end; row++) {
+		for (int column = 0; column < WIND_NODES; column++) {
+			int node = row * WIND_NODES + column;
+			const float *stream = psi + (row - begin + 1) * PSI_ROW + column + 1;
+			float x = column * h;
+			float y = row * h;
+
+			float fromX = x - u[node] * frames;
+			float fromY = y - v[node] * frames;
+			float carriedU, carriedV;
+			windAt(cells, fromX, fromY, &carriedU, &carriedV);
+
+			// Curl of the stream function: (d/dy, -d/dx).
+			float curlU = (stream[PSI_ROW] - stream[-PSI_ROW]) * amplitude / (2.0f * h);
+			float curlV = (stream[-1] - stream[1]) * amplitude / (2.0f * h);
+
+			nextU[node] = mix(carriedU, curlU + breeze, renew);
+			nextV[node] = mix(carriedV, curlV, renew);
+		}
+	}
+
+	float *nextCells = w->cells[!w->front];
+	for (int row = begin > 0 ? begin - 1 : 0; row < end - 1; row++) {
+		for (int column = 0; column < WIND_CELLS; column++) {
+			int node = row * WIND_NODES + column;
+			float *cell = nextCells + (row * WIND_CELLS + column) * WIND_CELL_FLOATS;
+			cell[0] = nextU[node];
+			cell[1] = nextU[node + 1];
+			cell[2] = nextU[node + WIND_NODES];
+			cell[3] = nextU[node + WIND_NODES + 1];
+			cell[4] = nextV[node];
+			cell[5] = nextV[node + 1];
+			cell[6] = nextV[node + WIND_NODES];
+			cell[7] = nextV[node + WIND_NODES + 1];
+		}
+	}
+}
+
+// Draw the breeze and the noise lattice for the next field, at buildTime.
+static void startField(Wind *w)
+{
+	float t = w->buildTime / WIND_NOISE_FRAMES;
+	w->breeze = WIND_BREEZE * (1.0f + WIND_GUST * noise(w->gustKey, 0.5f, 0.5f, t * 4.0f));
+	latticeAt(w->key, t, w->layer);
+}
+
+void initWind(Wind *w, uint32_t seed)
+{
+	memset(w, 0, sizeof(*w));
+	w->key = rngKey(seed, RNG_WIND, 0);
+	w->gustKey = rngKey(seed, RNG_WIND, 1);
+
+	// The first field comes straight from the noise, with nothing to carry along.
+	startField(w);
+	buildRows(w, 0, WIND_NODES, 1.0f, 1.0f);
+	w->front = 1;
+}
+
+void stepWind(Wind *w, float scale)
+{
+	// Each field is built for the time it takes over.
+	if (w->nextRow == 0) {
+		w->buildTime = w->time + WIND_TICKS_PER_FIELD * scale;
+		startField(w);
+	}
+
+	int end = w->nextRow + WIND_ROWS_PER_TICK;
+	end = end < WIND_NODES ? end : WIND_NODES;
+	buildRows(w, w->nextRow, end, scale, WIND_RENEW);
+	w->nextRow = end;
+	w->time += scale;
+
+	if (w->nextRow == WIND_NODES) {
+		w->front = !w->front;
+		w->nextRow = 0;
+	}
+}
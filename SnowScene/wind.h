@@ -0,0 +1,104 @@
+/******************************************************************************
+ *
+ * Wind
+ *
+ * A coarse grid of wind velocities over the window, which falling flakes
+ * sample with a bilinear lookup. Each field is the previous one carried along
+ * by itself (semi-Lagrangian advection), eased towards fresh curl noise plus
+ * a gusting breeze. Curl noise is the curl of a smooth scalar noise, so the
+ * flow has no sources or sinks: flakes swirl instead of bunching up.
+ *
+ * The next field is built a few rows per tick while flakes read the current
+ * one, and the two swap when it is done, so the cost per tick is a small,
+ * fixed amount whatever the number of flakes. Flakes read it by cell: each
+ * cell keeps copies of its four corners, so a lookup is two short loads.
+ *
+ * Velocities are in window widths per 60 Hz frame.
+ *
+ ******************************************************************************/
+
+#ifndef WIND_H
+#define WIND_H
+
+#include <stdint.h>
+
+// Cells across and up the window; the field has one more node than cells each way.
+#define WIND_CELLS 32
+#define WIND_NODES (WIND_CELLS + 1)
+
+// Rows of the next field built per tick. Fewer rows spread the cost thinner, but
+// make each field older by the time it is finished.
+#define WIND_ROWS_PER_TICK 2
+#define WIND_TICKS_PER_FIELD ((WIND_NODES + WIND_ROWS_PER_TICK - 1) / WIND_ROWS_PER_TICK)
+
+// Steady breeze to the right, and how far gusts take it either way (as a fraction).
+#define WIND_BREEZE 0.00005f
+#define WIND_GUST 0.8f
+
+/*
+	Size of the swirls. Value noise changes by at most 3 per lattice step, so
+	vertical gusts stay below 3 * WIND_TURBULENCE, less than the slowest flake
+	falls: every flake keeps falling.
+*/
+#define WIND_TURBULENCE 0.0001f
+
+// Noise lattice cells across the window, and 60 Hz frames per lattice step in time.
+#define WIND_NOISE_CELLS 4
+#define WIND_NOISE_FRAMES 300.0f
+
+// Noise lattice points per layer. Nodes just outside the window are sampled
+// too, so the lattice reaches one cell further each side.
+#define WIND_NOISE_POINTS ((WIND_NOISE_CELLS + 3) * (WIND_NOISE_CELLS + 3))
+
+// How far each new field moves towards the noise.
+#define WIND_RENEW 0.1f
+
+// Per cell: u at its bottom-left, bottom-right, top-left and top-right nodes, then v at the same.
+#define WIND_CELL_FLOATS 8
+
+typedef struct {
+	float u[2][WIND_NODES * WIND_NODES]; // across, row by row from the bottom
+	float v[2][WIND_NODES * WIND_NODES]; // up
+	float cells[2][WIND_CELLS * WIND_CELLS * WIND_CELL_FLOATS]; // both, by cell
+	int front;        // the field flakes read; the other is being built
+	int nextRow;      // rows of the next field built so far
+	float time;       // 60 Hz frames since the scene started
+	float buildTime;  // time the next field is built for
+	float breeze;     // the next field's breeze
+	float layer[WIND_NOISE_POINTS]; // and its noise lattice, blended to buildTime
+	uint32_t key;     // draws the swirls
+	uint32_t gustKey; // draws the breeze's gusts
+} Wind;
+
+// Build the first field from seed.
+void initWind(Wind *w, uint32_t seed);
+
+// Advance the wind by one tick of scale 60 Hz frames, building part of the next field.
+void stepWind(Wind *w, float scale);
+
+/*
+	The wind (u, v) at (x, y), interpolated between the corners of its cell in
+	cells. Outside the window the edge values are used. The particle update
+	does the same sums SIMD-wide, in the same order.
+*/
+static inline void windAt(const float *cells, float x, float y, float *u, float *v)
+{
+	float fx = x * WIND_CELLS;
+	float fy = y * WIND_CELLS;
+	fx = fx < 0.0f ? 0.0f : fx > WIND_CELLS ? WIND_CELLS : fx;
+	fy = fy < 0.0f ? 0.0f : fy > WIND_CELLS ? WIND_CELLS : fy;
+	int ix = (int)(fx < WIND_CELLS - 1 ? fx : WIND_CELLS - 1);
+	int iy = (int)(fy < WIND_CELLS - 1 ? fy : WIND_CELLS - 1);
+	float tx = fx - (float)ix;
+	float ty = fy - (float)iy;
+
+	const float *cell = cells + (iy * WIND_CELLS + ix) * WIND_CELL_FLOATS;
+	float bottom = cell[0] + (cell[1] - cell[0]) * tx;
+	float top = cell[2] + (cell[3] - cell[2]) * tx;
+	*u = bottom + (top - bottom) * ty;
+	bottom = cell[4] + (cell[5] - cell[4]) * tx;
+	top = cell[6] + (cell[7] - cell[6]) * tx;
+	*v = bottom + (top - bottom) * ty;
+}
+
+#endif